@@ -6,11 +6,74 @@
 #ifndef CSM_GUARD
 #define CSM_GUARD
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+
+#if !defined(CSM_NO_POSIX) &&                                                \
+    (defined(__APPLE__) ||                                                     \
+     (defined(__unix__) &&                                                     \
+      (!defined(__STRICT_ANSI__) || defined(_GNU_SOURCE) ||                    \
+       defined(_DEFAULT_SOURCE) ||                                             \
+       (defined(_POSIX_C_SOURCE) && (_POSIX_C_SOURCE + 0) >= 200809L) ||       \
+       (defined(_XOPEN_SOURCE) && (_XOPEN_SOURCE + 0) >= 500))))
+/**
+ * @def CSM_POSIX
+ * @brief It is defined when the file descriptor and mmap features are
+ * available, define CSM_NO_POSIX before including CSM.h to disable them
+ * @note in strict ISO mode(-std=c99) define _POSIX_C_SOURCE as 200809L or
+ * _XOPEN_SOURCE as 500 or more to get them, older values do not declare
+ * everything that is used
+ */
+#define CSM_POSIX
+#endif
+
+#ifdef CSM_POSIX
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(CSM_IO_URING) && defined(CSM_POSIX) && defined(__linux__)
+// MAP_POPULATE and syscall are not POSIX, strict ISO modes hide them
+#if defined(__STRICT_ANSI__) && !defined(_GNU_SOURCE) && !defined(_DEFAULT_SOURCE)
+#error "CSM_IO_URING needs _GNU_SOURCE or _DEFAULT_SOURCE in strict ISO mode(-std=c11)"
+#endif
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#else
+/**
+ * @brief It is the scatter-gather buffer of POSIX, it is defined here for the
+ * systems that do not have it
+ */
+struct iovec {
+  void *iov_base; /**< is the start of the buffer */
+  size_t iov_len; /**< is the size of the buffer */
+};
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+/**
+ * @def CSM_ATOMICS
+ * @brief It is defined when the compiler has the __atomic builtins, the
+ * features that are shared between threads or processes need it
+ */
+#define CSM_ATOMICS
+#endif
 /**\defgroup arena Arena Allocator struct and functions */
 /**\defgroup ptr_stack Ptr_stack struct and functions*/
 /**\defgroup dyn_ptr Dyn_ptr struct and functions */
@@ -34,6 +97,44 @@
 #define CSM_API static AInline
 #endif
 
+// CSM_INLINE_SIZE is not defined by default, if it is defined the payloads up
+// to that size are stored into the Dyn_ptr record itself instead of the arena
+#if defined(CSM_INLINE_SIZE) && CSM_INLINE_SIZE <= 0
+#undef CSM_INLINE_SIZE
+#endif
+
+// CSM_COMPACT_DYN_PTR is not defined by default, if it is defined Dyn_ptr is
+// 16 bytes: a 32 bit size and a 32 bit id into the deallocator table of the
+// Ptr_stack replace the size_t and the function pointer
+#ifdef CSM_COMPACT_DYN_PTR
+#define CSM_MAX_PTR_SIZE UINT32_MAX
+#else
+/**
+ * @brief It is the biggest size that a Dyn_ptr can hold
+ */
+#define CSM_MAX_PTR_SIZE SIZE_MAX
+#endif
+
+#ifndef CSM_ALIGNMENT
+/**
+ * @brief It is the alignment used for blocks that hold structs, like the
+ * Dyn_off_ptr blocks, it must be a power of two
+ */
+#define CSM_ALIGNMENT 8
+#endif
+
+/**
+ * @ingroup arena
+ * @enum Arena_kind
+ * @brief It says where the memory of a Arena comes from
+ */
+typedef enum {
+  CSM_ARENA_HEAP = 0, /**< Arena::block comes from malloc and it can grow */
+  CSM_ARENA_MAPPED, /**< Arena::block is inside a mmap and it can not grow */
+  CSM_ARENA_SHARED, /**< Arena::block is shared between processes, the bump pointer is atomic */
+  CSM_ARENA_SHARED_READ_ONLY, /**< Arena::block is shared between processes and this side only reads */
+} Arena_kind;
+
 /**
  * @ingroup arena
  * @struct Arena
@@ -41,11 +142,17 @@
  * @param capacity the capacity of the arena
  * @param actual_size the size of the content allocated into arena
  * @param block the raw memory block of the arena
+ * @param kind where the block comes from
+ * @param mapping the start of the mmap that holds the block if it is mapped
+ * @param mapping_size the size of Arena::mapping
  */
 typedef struct {
   size_t capacity; /**< is the maximum amount of "blocks" that Arena can hold*/
   size_t actual_size; /**< is the quantity of blocks into Arena in this moment */
   uint8_t *block; /**< is the raw memory block into Arena */
+  Arena_kind kind; /**< is where Arena::block comes from */
+  void *mapping; /**< is the mmap that holds Arena::block, NULL for heap arenas */
+  size_t mapping_size; /**< is the size of Arena::mapping */
 } Arena;
 
 /**
@@ -77,6 +184,17 @@ CSM_API Arena *create_arena(size_t capacity);
  */
 CSM_API Arena_ptr arena_alloc(Arena *arena, size_t size);
 
+/**
+ * @ingroup arena
+ * @fn Arena_ptr arena_alloc_aligned(Arena *arena, size_t size, size_t align)
+ * @brief It gets a block from arena allocator whose offset from Arena::block is
+ * a multiple of align
+ * @param arena is the arena allocator
+ * @param size is a size_t that defines the size of the requested block
+ * @param align is the alignment, it must be a power of two
+ */
+CSM_API Arena_ptr arena_alloc_aligned(Arena *arena, size_t size, size_t align);
+
 /**
  * @ingroup arena
  * @fn Arena *arena_free(Arena *arena)
@@ -95,19 +213,259 @@ CSM_API void arena_free(Arena *arena);
  */
 CSM_API bool arena_realloc(Arena *arena, size_t extra_capacity);
 
+/**
+ * @ingroup arena
+ * @fn Arena *arena_clone(const Arena *arena)
+ * @brief It creates a copy of the arena, the block is copied with a single memcpy
+ * @param arena is the arena that is gonna be copied
+ * @return a new arena allocated in heap or NULL if there is no memory, every
+ * Dyn_off_ptr and Rel_ptr of the old arena is valid in the new one
+ */
+CSM_API Arena *arena_clone(const Arena *arena);
+
+/**
+ * @ingroup arena
+ * @struct Rel_ptr
+ * @brief A self-relative pointer, it stores the distance from itself to the
+ * target so it keeps working when the memory that holds both is moved, copied
+ * or mapped at other address
+ * @param offset the distance in bytes from the Rel_ptr to the target, 0 means NULL
+ */
+typedef struct {
+  ptrdiff_t offset; /**< is the distance from the Rel_ptr to the target, 0 is NULL */
+} Rel_ptr;
+
+/**
+ * @ingroup arena
+ * @fn void rel_ptr_set(Rel_ptr *rel, const void *target)
+ * @brief It makes the Rel_ptr point to target
+ * @param rel is the Rel_ptr, it must live in the same block as target
+ * @param target is the address that is gonna be pointed or NULL
+ */
+CSM_API void rel_ptr_set(Rel_ptr *rel, const void *target);
+
+/**
+ * @ingroup arena
+ * @fn void *rel_ptr_get(const Rel_ptr *rel)
+ * @brief It gets the address that the Rel_ptr points to
+ * @param rel is the Rel_ptr
+ * @return the target address or NULL
+ */
+CSM_API void *rel_ptr_get(const Rel_ptr *rel);
+
 /**
  * @ingroup dyn_ptr
  * @brief A Dynamic pointer, it free memory automatically
  * @param ptr is a void * pointer that contains the raw memory block from the arena allocator
  * @param size is the size of the memory into Dyn_ptr
  * @param dealloc this is func ptr for define a deallocator that is like a destructor this is for edge cases and is optional
+ * @param dealloc_id replaces Dyn_ptr::dealloc when CSM_COMPACT_DYN_PTR is
+ * defined, it is a index into the deallocator table of the Ptr_stack
+ * @param inline_data holds the payloads up to CSM_INLINE_SIZE bytes when it is
+ * defined, then Dyn_ptr::ptr points to it, so a copy of the record still
+ * points into the original record
  */
 typedef struct Dyn_ptr {
   void *ptr; /**< is the raw memory that Dyn_ptr holds*/
+#ifdef CSM_COMPACT_DYN_PTR
+  uint32_t size; /**< is the size of Dyn_ptr::ptr */
+  uint32_t dealloc_id; /**< is the index of the deallocator into Ptr_stack::deallocs */
+#else
   size_t size; /**< is the size of Dyn_ptr::ptr */
   void (*dealloc)(struct Dyn_ptr *); /**< is a function ptr that have the deallocator for the data, NOTE:this is just optional */
+#endif
+#ifdef CSM_INLINE_SIZE
+  uint8_t inline_data[CSM_INLINE_SIZE]; /**< holds the small payloads, Dyn_ptr::ptr points here for them */
+#endif
 } Dyn_ptr;
 
+/**
+ * @ingroup dyn_ptr
+ * @struct Dyn_off_ptr
+ * @brief A Dyn_ptr that stores the offset from Arena::block instead of an
+ * address, so it keeps valid when the arena is moved, copied, persisted or
+ * mapped in other process
+ * @param offset is the distance in bytes from Arena::block to the data
+ * @param size is the size of the data, 0 means a invalid Dyn_off_ptr
+ */
+typedef struct {
+  size_t offset; /**< is the distance from Arena::block to the data */
+  size_t size; /**< is the size of the data, 0 if the allocation failed */
+} Dyn_off_ptr;
+
+/**
+ * @ingroup dyn_ptr
+ * @def get_dyn_off_ptr_data(T, arena, off_ptr)
+ * @brief it resolves a Dyn_off_ptr against a arena and it returns the data as T
+ * @param T is the type to what the data is gonna transform
+ * @param arena is the Arena where the data lives
+ * @param off_ptr is a pointer to the Dyn_off_ptr
+ */
+#define get_dyn_off_ptr_data(T, arena, off_ptr) \
+  ((T *)((arena)->block + (off_ptr)->offset))
+
+/**
+ * @ingroup arena
+ * @fn Dyn_off_ptr arena_alloc_off(Arena *arena, size_t size)
+ * @brief It gets a block aligned to CSM_ALIGNMENT from arena allocator and
+ * returns it as a offset
+ * @param arena is the arena allocator
+ * @param size is the size of the requested block
+ * @return the Dyn_off_ptr, the size is 0 if there is no space
+ */
+CSM_API Dyn_off_ptr arena_alloc_off(Arena *arena, size_t size);
+
+/**\defgroup vec Arena_vec struct and functions */
+
+struct Ptr_stack;
+
+/**
+ * @ingroup vec
+ * @struct Arena_vec
+ * @brief A growable array whose elements live into a Arena, the data is kept
+ * as a offset so it keeps valid when the arena grows and moves
+ * @param arena is the arena where the elements live
+ * @param offset is the distance from Arena::block to the first element
+ * @param length is the number of elements
+ * @param capacity is the number of elements that fit before it grows
+ * @param elem_size is the size of one element
+ * @param stack is the Ptr_stack that owns Arena_vec::arena or NULL
+ */
+typedef struct {
+  Arena *arena; /**< is the arena where the elements live */
+  size_t offset; /**< is the distance from Arena::block to the first element */
+  size_t length; /**< is the number of elements */
+  size_t capacity; /**< is the number of elements that fit before it grows */
+  size_t elem_size; /**< is the size of one element */
+  struct Ptr_stack *stack; /**< is the Ptr_stack that owns Arena_vec::arena or NULL */
+} Arena_vec;
+
+/**
+ * @ingroup vec
+ * @fn bool arena_vec_init(Arena_vec *vec, Arena *arena, size_t elem_size, size_t capacity)
+ * @brief It initializes a empty Arena_vec
+ * @param vec is the Arena_vec
+ * @param arena is the arena where the elements are gonna live
+ * @param elem_size is the size of one element
+ * @param capacity is the initial capacity, 0 allocates nothing yet
+ * @return false if there is no memory or elem_size is 0
+ * @note arena must not be the arena of a Ptr_stack, its growth would move
+ * the block without rebasing Ptr_stack::ptr_list, stack_vec_init is for that
+ */
+CSM_API bool arena_vec_init(Arena_vec *vec, Arena *arena, size_t elem_size,
+                            size_t capacity);
+
+/**
+ * @ingroup vec
+ * @fn bool arena_vec_reserve(Arena_vec *vec, size_t capacity)
+ * @brief It makes room for capacity elements, if the elements are the last
+ * allocation of the arena they are extended in place, if not they are copied
+ * into a new block
+ * @param vec is the Arena_vec
+ * @param capacity is the number of elements that must fit
+ * @return false if there is no memory
+ * @note a heap arena is grown with arena_realloc when it is full, the old
+ * block of a copied Arena_vec stays into the arena until arena_free, the
+ * doubling of arena_vec_push keeps that waste under the size of the Arena_vec,
+ * with stack_vec_init the Ptr_stack allocates the blocks and it reuses the
+ * old ones
+ */
+CSM_API bool arena_vec_reserve(Arena_vec *vec, size_t capacity);
+
+/**
+ * @ingroup vec
+ * @fn void *arena_vec_push(Arena_vec *vec)
+ * @brief It adds a uninitialized element at the end, the capacity doubles
+ * when it is full
+ * @param vec is the Arena_vec
+ * @return the new element or NULL if there is no memory
+ */
+CSM_API void *arena_vec_push(Arena_vec *vec);
+
+/**
+ * @ingroup vec
+ * @def arena_vec_at(T, vec, index)
+ * @brief it gets a element of a Arena_vec as T
+ * @param T is the type of the elements
+ * @param vec is a pointer to the Arena_vec
+ * @param index is the index of the element, it is not checked
+ */
+#define arena_vec_at(T, vec, index)                                            \
+  ((T *)((vec)->arena->block + (vec)->offset) + (index))
+
+/**
+ * @ingroup vec
+ * @def CSM_VEC_DEFINE(name, T)
+ * @brief It defines name as a Arena_vec of T and its functions name_init,
+ * name_init_stack, name_reserve, name_push, name_pop, name_at, name_data and
+ * name_len, the element access is inlined
+ * @param name is the name of the new type
+ * @param T is the type of the elements
+ * @note name_pop must not be called on a empty name, like arena_vec_at it is
+ * not checked
+ */
+#define CSM_VEC_DEFINE(name, T)                                                \
+  typedef struct {                                                             \
+    Arena_vec vec;                                                             \
+  } name;                                                                      \
+  static AInline bool name##_init(name *v, Arena *arena, size_t capacity) {    \
+    return arena_vec_init(&v->vec, arena, sizeof(T), capacity);                \
+  }                                                                            \
+  static AInline bool name##_init_stack(name *v, struct Ptr_stack *stack,      \
+                                        size_t capacity) {                     \
+    return stack_vec_init(&v->vec, stack, sizeof(T), capacity);                \
+  }                                                                            \
+  static AInline bool name##_reserve(name *v, size_t capacity) {               \
+    return arena_vec_reserve(&v->vec, capacity);                               \
+  }                                                                            \
+  static AInline bool name##_push(name *v, T value) {                          \
+    T *slot = (T *)arena_vec_push(&v->vec);                                    \
+    if (slot == NULL)                                                          \
+      return false;                                                            \
+    *slot = value;                                                             \
+    return true;                                                               \
+  }                                                                            \
+  static AInline T name##_pop(name *v) {                                       \
+    return *arena_vec_at(T, &v->vec, --v->vec.length);                         \
+  }                                                                            \
+  static AInline T *name##_at(name *v, size_t index) {                         \
+    return arena_vec_at(T, &v->vec, index);                                    \
+  }                                                                            \
+  static AInline T *name##_data(name *v) {                                     \
+    return arena_vec_at(T, &v->vec, 0);                                        \
+  }                                                                            \
+  static AInline size_t name##_len(const name *v) { return v->vec.length; }
+
+#ifndef CSM_SIZE_CLASSES
+#define CSM_SIZE_CLASSES 13 // the released blocks are kept by size from 16B to 64KB
+#endif
+
+struct Csm_remote;
+struct Stack_epoch;
+
+/**
+ * @ingroup ptr_stack
+ * @brief It counts what the dedup mode of stack_new_ptr did, the hit rate is
+ * Dedup_stats::hits / Dedup_stats::lookups
+ */
+typedef struct {
+  size_t lookups; /**< is the number of payloads looked up into the table */
+  size_t hits; /**< is the number of payloads that shared a block */
+  size_t bytes_saved; /**< is the sum of the sizes of the shared payloads */
+} Dedup_stats;
+
+/**
+ * @ingroup ptr_stack
+ * @brief It links a deallocator with a function that destroys many Dyn_ptr's
+ * of that deallocator in one call
+ * @param dealloc is the deallocator of the Dyn_ptr's
+ * @param batch is called with the Dyn_ptr's that have dealloc, in LIFO order
+ */
+typedef struct {
+  void (*dealloc)(Dyn_ptr *); /**< is the deallocator of the Dyn_ptr's */
+  void (*batch)(Dyn_ptr **dyn_ptrs, size_t count); /**< destroys count Dyn_ptr's at once */
+} Dealloc_group;
+
 /**
  * @ingroup ptr_stack
  * @brief it's a dynamic list that manage all Dyn_ptr's
@@ -116,12 +474,46 @@ typedef struct Dyn_ptr {
  * @param arena is the arena allocator that Ptr_stack uses
  * @param ptr_list is a dynamic array of Dyn_ptr's
  * @param length is the actual length of the Ptr_stack
+ * @note Ptr_stack::ptr_list is realloc'ed when it is full, so every call that
+ * adds a Dyn_ptr(stack_new_ptr, stack_alloc_uninit, stack_new_ptrs,
+ * stack_cow_clone...) can invalidate all the Dyn_ptr * of the stack, the index
+ * of a Dyn_ptr into Ptr_stack::ptr_list stays valid
  */
-typedef struct {
+typedef struct Ptr_stack {
   Arena *arena; /**< arena is the arena allocator used for Ptr_stack */
   Dyn_ptr *ptr_list; /**< ptr_list is the dynamic list that holds all Dyn_ptr's from Ptr_stack */
   size_t length; /**< is the number of Dyn_ptr's that is into Ptr_stack */
   size_t capacity; /**< is the quantity of how many Dyn_ptr's Ptr_stack can hold */
+#ifdef CSM_COMPACT_DYN_PTR
+  void (**deallocs)(Dyn_ptr *); /**< is the deallocator table that Dyn_ptr::dealloc_id indexes */
+  uint32_t dealloc_count; /**< is the number of deallocators into Ptr_stack::deallocs */
+  uint32_t dealloc_capacity; /**< is the capacity of Ptr_stack::deallocs */
+#endif
+  size_t *dtors; /**< are the indexes of the Dyn_ptr's that have a deallocator, stack_free only visits them */
+  size_t dtor_count; /**< is the number of indexes into Ptr_stack::dtors */
+  size_t dtor_capacity; /**< is the capacity of Ptr_stack::dtors */
+  size_t *dtor_marks; /**< is a bit per slot of Ptr_stack::ptr_list that tells if the slot is already into Ptr_stack::dtors */
+  size_t dtor_mark_words; /**< is the number of words into Ptr_stack::dtor_marks */
+  size_t *rc_marks; /**< is a bit per slot of Ptr_stack::ptr_list that tells if the slot holds a strong reference of stack_new_rc */
+  size_t rc_mark_words; /**< is the number of words into Ptr_stack::rc_marks */
+#ifndef CSM_COMPACT_DYN_PTR
+#endif
+  Dealloc_group *groups; /**< are the batch deallocators in order of registration */
+  size_t group_count; /**< is the number of Dealloc_group's into Ptr_stack::groups */
+  size_t *barriers; /**< are positions into Ptr_stack::dtors set by stack_free_barrier */
+  size_t barrier_count; /**< is the number of positions into Ptr_stack::barriers */
+  size_t free_lists[CSM_SIZE_CLASSES]; /**< are the arena offsets of the first released block of each size class, SIZE_MAX if there is none */
+  struct Csm_remote *remote; /**< is the queue of stack_release_ptr_remote or NULL */
+  struct Stack_epoch *epoch; /**< is the Stack_epoch of the stack or NULL */
+  Dyn_off_ptr dedup; /**< is the hash table of stack_enable_dedup into the arena, its size is 0 if it is off */
+  Dyn_off_ptr dedup_refs; /**< is the table of the shared blocks by offset with their share counts, it has the slots of Ptr_stack::dedup */
+  size_t dedup_count; /**< is the number of payloads into Ptr_stack::dedup */
+  Dedup_stats dedup_stats; /**< are the counters of the dedup mode */
+  Dyn_off_ptr interns; /**< is the hash table of csm_intern into the arena, its size is 0 until the first call */
+  size_t intern_count; /**< is the number of strings into Ptr_stack::interns */
+  char *intern_chunk; /**< is the free space of the last chunk of interned strings */
+  size_t intern_left; /**< is the size of Ptr_stack::intern_chunk */
+  size_t intern_index; /**< is the index of the Dyn_ptr of the last chunk, its size is the used part */
 } Ptr_stack;
 
 /**
@@ -132,7 +524,8 @@ typedef struct {
  * @param dyn_ptr is the dyn_ptr where data is gonna be inserted
  * @param stack is the stack where the pointer is into
  * @param data is the data that is gonna be inserted
- * @param size is the length of the data that is gonna be inserted
+ * @param size is the length of the data that is gonna be inserted, nothing is
+ * done if it is bigger than CSM_MAX_PTR_SIZE
  */
 
 CSM_API void dyn_ptr_alloc(Ptr_stack *stack, Dyn_ptr *dyn_ptr, void *data, size_t size);
@@ -142,10 +535,31 @@ CSM_API void dyn_ptr_alloc(Ptr_stack *stack, Dyn_ptr *dyn_ptr, void *data, size_
  * @brief It insert the new deallocator
  * @param dyn_ptr is the dyn_ptr where the new deallocator is gonna be inserted
  * @param dealloc is the deallocator that is gonna be inserted
+ * @note the Ptr_stack of dyn_ptr is looked up by the address of dyn_ptr into a
+ * list of the live stacks and the deallocator is registered like with
+ * stack_insert_deallocator, that one skips the look up, when
+ * CSM_COMPACT_DYN_PTR is defined a Dyn_ptr outside of every Ptr_stack can not
+ * have a deallocator and it is left as it is
  */
 
 CSM_API void dyn_ptr_insert_deallocator(Dyn_ptr *dyn_ptr, void (*dealloc)(Dyn_ptr *));
 
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn bool stack_insert_deallocator(Ptr_stack *stack, Dyn_ptr *dyn_ptr, void (*dealloc)(Dyn_ptr *))
+ * @brief It insert the new deallocator and it registers the Dyn_ptr into the
+ * Ptr_stack, so stack_free visits only the Dyn_ptr's that have one, it is
+ * dyn_ptr_insert_deallocator without the look up of the Ptr_stack
+ * @param stack is the stack where the pointer is into
+ * @param dyn_ptr is the dyn_ptr where the new deallocator is gonna be inserted
+ * @param dealloc is the deallocator that is gonna be inserted, NULL removes it
+ * @return false if there is no memory
+ */
+CSM_API bool stack_insert_deallocator(Ptr_stack *stack, Dyn_ptr *dyn_ptr,
+                                      void (*dealloc)(Dyn_ptr *));
+
 /**
  * @ingroup dyn_ptr
  * @brief Is just the placeholder for the deallocator for dyn_ptr
@@ -178,166 +592,3847 @@ CSM_API Ptr_stack *create_stack(size_t capacity);
  * @brief It creates a Dyn_ptr and it allocate it on Ptr_stack
  * @param stack the Ptr_stack
  * @param dataSize the size of the data that is gonna be inserted into the ptr
- * @param data is the data that is gonna be inserted into ptr
+ * @param data is the data that is gonna be inserted into ptr, it can be the
+ * data of other Dyn_ptr of the stack even when the arena moves
+ * @return the Dyn_ptr, it is valid until the next call that adds a Dyn_ptr to
+ * the stack, it can realloc Ptr_stack::ptr_list, keep its index
+ * (dyn_ptr - stack->ptr_list) across those calls
+ * @note the data is aligned to CSM_ALIGNMENT, if the arena grows the data can
+ * move to other address and Ptr_stack::ptr_list is updated, so the raw address
+ * is not kept either, it is read again from the Dyn_ptr at its index
  */
 CSM_API Dyn_ptr *stack_new_ptr(Ptr_stack *stack, void *data, size_t dataSize);
 
 /**
- * @ingroup ptr_stack
-  
- * @fn void stack_free(Ptr_stack *stack)
- * @brief It free the Ptr_stack
- * @param stack is the Ptr_stack that is gonna be freed
- */
-CSM_API void stack_free(Ptr_stack *stack);
-
-#ifdef CSM_IMPLEMENTATION
-Arena *create_arena(size_t capacity) {
-  Arena *arena = (Arena *)malloc(sizeof(Arena));
-
-  if (arena == NULL) {
-    return NULL;
-  }
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
 
-  arena->capacity = capacity;
-  arena->actual_size = 0;
-  arena->block = (uint8_t *)malloc(arena->capacity);
+ * @fn Dyn_ptr *stack_alloc_uninit(Ptr_stack *stack, size_t size)
+ * @brief It creates a Dyn_ptr whose data is uninitialized arena memory, so the
+ * caller writes into it directly instead of copying from other buffer
+ * @param stack the Ptr_stack
+ * @param size the size of the data
+ * @return the Dyn_ptr or NULL if there is no memory or size is 0
+ */
+CSM_API Dyn_ptr *stack_alloc_uninit(Ptr_stack *stack, size_t size);
 
-  if (arena->block == NULL) {
-    free(arena);
-    return NULL;
-  }
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
 
-  return arena;
-}
+ * @fn Dyn_ptr *stack_emplace(Ptr_stack *stack, size_t size, void (*init)(void *ptr, size_t size, void *arg), void *arg)
+ * @brief It creates a Dyn_ptr and it constructs the data in place with init
+ * @param stack the Ptr_stack
+ * @param size the size of the data
+ * @param init is the function that initializes the data, it gets the arena
+ * memory, the size and arg
+ * @param arg is passed as is to init
+ * @return the Dyn_ptr or NULL if there is no memory or size is 0
+ */
+CSM_API Dyn_ptr *stack_emplace(Ptr_stack *stack, size_t size,
+                               void (*init)(void *ptr, size_t size, void *arg),
+                               void *arg);
 
-Arena_ptr arena_alloc(Arena *arena, size_t size) {
-  if (arena == NULL || size == 0)
-    return (Arena_ptr){.size = 0, .block = NULL};
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
 
-  if (arena->actual_size + size > arena->capacity)
-    return (Arena_ptr){.size = 0, .block = NULL};
+ * @fn bool stack_new_ptrs(Ptr_stack *stack, const struct iovec *iov, size_t count, Dyn_ptr **out)
+ * @brief It creates count Dyn_ptr's at once, the Ptr_stack::ptr_list slots and
+ * the arena space are reserved one time and the payloads are copied in one pass
+ * @param stack the Ptr_stack
+ * @param iov are the payloads, a empty one gives a Dyn_ptr with NULL data,
+ * they can be into the arena of the stack like in stack_new_ptr
+ * @param count is the number of payloads
+ * @param out if it is not NULL it gets the first Dyn_ptr, the others follow it
+ * into Ptr_stack::ptr_list
+ * @return false if there is no memory, then nothing is created
+ */
+CSM_API bool stack_new_ptrs(Ptr_stack *stack, const struct iovec *iov,
+                            size_t count, Dyn_ptr **out);
 
-  uint8_t *block = &arena->block[arena->actual_size];
-  arena->actual_size += size;
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
 
-  return (Arena_ptr){.size = size, .block = block};
-}
+ * @fn Dyn_off_ptr stack_new_off_ptr(Ptr_stack *stack, void *data, size_t dataSize)
+ * @brief It copies data into the arena of the Ptr_stack and returns it as a
+ * Dyn_off_ptr, the arena grows if it is needed and the offset keeps valid
+ * @param stack the Ptr_stack
+ * @param data is the data that is gonna be inserted
+ * @param dataSize the size of the data
+ * @return the Dyn_off_ptr, the size is 0 if there is no memory
+ * @note Dyn_off_ptr's are not into Ptr_stack::ptr_list so they have no deallocator
+ */
+CSM_API Dyn_off_ptr stack_new_off_ptr(Ptr_stack *stack, void *data, size_t dataSize);
 
-bool arena_realloc(Arena *arena, size_t extra_capacity) {
-  void *ptr = realloc(arena->block, arena->actual_size + extra_capacity);
-  if (ptr == NULL)
-    return false;
-  arena->block = (uint8_t *)ptr;
-  arena->capacity += extra_capacity;
-  return true;
-}
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
 
-void arena_free(Arena *arena) {
-  free(arena->block);
-  free(arena);
-}
+ * @fn Dyn_ptr *stack_adopt_ptr(Ptr_stack *stack, void *ptr, size_t size, void (*dealloc)(Dyn_ptr *))
+ * @brief It registers a buffer that already exists as a Dyn_ptr without
+ * copying it into the arena
+ * @param stack the Ptr_stack
+ * @param ptr is the buffer that is gonna be adopted
+ * @param size is the size of the buffer
+ * @param dealloc is the deallocator that releases the buffer in stack_free,
+ * for example one that calls free(dyn_ptr->ptr), NULL means that the caller
+ * keeps the ownership
+ * @return the Dyn_ptr or NULL if Ptr_stack::ptr_list can not grow
+ */
+CSM_API Dyn_ptr *stack_adopt_ptr(Ptr_stack *stack, void *ptr, size_t size,
+                                 void (*dealloc)(Dyn_ptr *));
 
-Ptr_stack *create_stack(size_t capacity) {
-  Ptr_stack *ptr_stack = (Ptr_stack *)malloc(sizeof(Ptr_stack));
-  if (ptr_stack == NULL)
-    return NULL;
+/**
+ * @ingroup ptr_stack
 
-  Dyn_ptr *dyn_ptrs = (Dyn_ptr *)malloc(capacity * sizeof(Dyn_ptr));
-  if (dyn_ptrs == NULL) {
-    free(ptr_stack);
-    return NULL;
-  }
+ * @fn bool stack_register_batch_deallocator(Ptr_stack *stack, void (*dealloc)(Dyn_ptr *), void (*batch)(Dyn_ptr **dyn_ptrs, size_t count))
+ * @brief It registers a function that destroys all the Dyn_ptr's of the
+ * deallocator dealloc in one call, so stack_free does not call dealloc once
+ * per Dyn_ptr
+ * @param stack the Ptr_stack
+ * @param dealloc is the deallocator of the Dyn_ptr's, registering it again
+ * replaces its batch function
+ * @param batch gets the Dyn_ptr's of dealloc in LIFO order
+ * @return false if there is no memory
+ */
+CSM_API bool stack_register_batch_deallocator(Ptr_stack *stack,
+                                              void (*dealloc)(Dyn_ptr *),
+                                              void (*batch)(Dyn_ptr **dyn_ptrs,
+                                                            size_t count));
 
-  ptr_stack->capacity = capacity; // Initialize capacity
-  Arena *arena = create_arena(ptr_stack->capacity);
-  if (arena == NULL) {
-    free(dyn_ptrs);
-    free(ptr_stack);
-    return NULL;
-  }
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
 
-  ptr_stack->length = 0;
-  ptr_stack->ptr_list = dyn_ptrs;
-  ptr_stack->arena = arena;
+ * @fn bool stack_release_ptr(Ptr_stack *stack, Dyn_ptr *dyn_ptr)
+ * @brief It destroys a Dyn_ptr before stack_free, the deallocator is called
+ * and the arena block is kept into a free list of the Ptr_stack so the next
+ * allocations of a similar size reuse it
+ * @param stack the Ptr_stack
+ * @param dyn_ptr is a Dyn_ptr of the stack, after the call its data is NULL
+ * and its size is 0
+ * @return false if dyn_ptr was already released
+ * @note only blocks of 16 bytes or more that live into a heap arena are
+ * reused, the slot of Ptr_stack::ptr_list is not reused
+ */
+CSM_API bool stack_release_ptr(Ptr_stack *stack, Dyn_ptr *dyn_ptr);
 
-  return ptr_stack;
-}
+/**
+ * @ingroup ptr_stack
 
-Dyn_ptr *stack_new_ptr(Ptr_stack *stack, void *data, size_t dataSize) {
-  size_t growth = dataSize * (size_t)2;
-  if (growth < 1024) { // minimum of 1KB growth.
-    growth = 1024;
-  }
-  if (stack->length >= stack->capacity && !arena_realloc(stack->arena, growth)) {
-    return NULL;
-  }
+ * @fn bool stack_enable_dedup(Ptr_stack *stack, size_t slots)
+ * @brief It turns on the dedup mode of stack_new_ptr, the payloads are hashed
+ * and looked up into a table that lives into the arena, a payload that is
+ * already there gives a Dyn_ptr that shares its block instead of a copy
+ * @param stack the Ptr_stack
+ * @param slots is the initial number of slots of the table, it is rounded up
+ * to a power of 2 and it doubles when it is 3/4 full
+ * @return false if there is no memory
+ * @note the shared blocks must be only read, each one keeps a share count and
+ * stack_release_ptr reuses it when its last Dyn_ptr is released, the payloads
+ * that fit into a Dyn_ptr are not shared
+ */
+CSM_API bool stack_enable_dedup(Ptr_stack *stack, size_t slots);
 
-  Arena_ptr arena_ptr = arena_alloc(stack->arena, sizeof(Dyn_ptr));
-  if (arena_ptr.block == NULL) {
-    return NULL;
-  }
+/**
+ * @ingroup ptr_stack
 
-  Dyn_ptr *dyn_ptr = (Dyn_ptr *)arena_ptr.block;
-  dyn_ptr->ptr = NULL;
+ * @fn Dedup_stats stack_dedup_stats(const Ptr_stack *stack)
+ * @brief It gets the counters of the dedup mode
+ * @param stack the Ptr_stack
+ */
+CSM_API Dedup_stats stack_dedup_stats(const Ptr_stack *stack);
 
-  stack->ptr_list[stack->length] = *dyn_ptr;
-  stack->length++;
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup vec
 
-  dyn_ptr = &stack->ptr_list[stack->length - 1];
-  dyn_ptr->size = dataSize;
-  dyn_ptr->dealloc = null_deallocator;
-  dyn_ptr_alloc(stack, dyn_ptr, data, dataSize);
-  if (dyn_ptr->ptr == NULL)
-    return NULL;
-  return dyn_ptr;
-}
+ * @fn bool stack_vec_init(Arena_vec *vec, Ptr_stack *stack, size_t elem_size, size_t capacity)
+ * @brief It initializes a empty Arena_vec into the arena of a Ptr_stack, it
+ * grows with the allocator of the Ptr_stack so Ptr_stack::ptr_list is rebased
+ * when the arena moves
+ * @param vec is the Arena_vec
+ * @param stack is the Ptr_stack whose arena holds the elements
+ * @param elem_size is the size of one element
+ * @param capacity is the initial capacity, 0 allocates nothing yet
+ * @return false if there is no memory or elem_size is 0
+ */
+CSM_API bool stack_vec_init(Arena_vec *vec, Ptr_stack *stack, size_t elem_size,
+                            size_t capacity);
 
-void dyn_ptr_alloc(Ptr_stack *stack, Dyn_ptr *dyn_ptr, void *data,
-                   size_t size) {
-  if (stack == NULL || dyn_ptr == NULL || data == NULL || size == 0) {
-    return;
-  }
+/**
+ * @ingroup ptr_stack
 
-  Arena_ptr data_arena_ptr = arena_alloc(stack->arena, size);
+ * @fn const char *csm_intern(Ptr_stack *stack, const char *str, size_t len)
+ * @brief It interns a string, every call with the same bytes returns the same
+ * pointer so the interned strings can be compared with ==
+ * @param stack the Ptr_stack that owns the strings until stack_free
+ * @param str is the string, it does not need to end with '\0'
+ * @param len is the length of str
+ * @return the interned copy, it ends with '\0' and it never moves, or NULL if
+ * there is no memory
+ * @note the index is a open addressing table into the arena, the strings are
+ * packed into chunks of CSM_INTERN_CHUNK bytes that are adopted as Dyn_ptr's
+ * of the stack, so they do not move when the arena grows, do not release them,
+ * the size of those Dyn_ptr's is the used part of the chunk and
+ * stack_snapshot writes them as empty Dyn_ptr's like the file ones
+ */
+CSM_API const char *csm_intern(Ptr_stack *stack, const char *str, size_t len);
 
-  if (data_arena_ptr.block == NULL) {
-    return;
-  }
+/**
+ * @ingroup ptr_stack
 
-  memcpy(data_arena_ptr.block, data, size);
+ * @fn bool stack_free_barrier(Ptr_stack *stack)
+ * @brief It marks that the deallocators inserted after this call depend on
+ * the ones inserted before it, so stack_free_parallel finishes all the later
+ * ones before it starts with the earlier ones
+ * @param stack the Ptr_stack
+ * @return false if there is no memory
+ */
+CSM_API bool stack_free_barrier(Ptr_stack *stack);
 
-  dyn_ptr->ptr = data_arena_ptr.block;
-  dyn_ptr->size = size; /// ? It should be size or data_arena_ptr.size
-}
+/**
+ * @ingroup ptr_stack
+  
+ * @fn void stack_free(Ptr_stack *stack)
+ * @brief It free the Ptr_stack
+ * @param stack is the Ptr_stack that is gonna be freed
+ * @note the deallocators run in LIFO order, the consecutive Dyn_ptr's whose
+ * deallocator has a batch function are destroyed together, up to
+ * CSM_BATCH_SIZE at once
+ */
+CSM_API void stack_free(Ptr_stack *stack);
 
-void dyn_ptr_insert_deallocator(Dyn_ptr *dyn_ptr, void (*dealloc)(Dyn_ptr *)) {
-  dyn_ptr->dealloc = dealloc;
-}
+/**
+ * @ingroup ptr_stack
 
-void null_deallocator(Dyn_ptr *_) {
-  (void)_;
-};
+ * @fn bool stack_free_step(Ptr_stack *stack, size_t max_items)
+ * @brief It runs up to max_items deallocators of the Ptr_stack in LIFO order
+ * and when there are no more it frees the Ptr_stack, so the teardown can be
+ * split across many calls
+ * @param stack is the Ptr_stack that is gonna be freed
+ * @param max_items is the most deallocators that are run in this call
+ * @return true if the Ptr_stack was freed, false if it must be called again
+ * @note the Ptr_stack must not be used between the calls
+ */
+CSM_API bool stack_free_step(Ptr_stack *stack, size_t max_items);
 
-#undef get_dyn_ptr_data
+/**\defgroup ptr_stack_soa Ptr_stack_soa struct and functions */
 
 /**
- * @def get_dyn_ptr_data(T, dyn_ptr)
- * @brief it transform Dyn_ptr data to a specific type and it returns it
+ * @ingroup ptr_stack_soa
+ * @brief It is other layout of Ptr_stack, the pointers, the sizes and the
+ * deallocators live into separated arrays, so stack_soa_free only reads
+ * Ptr_stack_soa::dealloc_ids and the sizes can be summed with SIMD
+ * @param arena is the arena where the data is stored
+ * @param ptrs are the pointers to the data
+ * @param sizes are the sizes of the data
+ * @param dealloc_ids are the indexes into Ptr_stack_soa::deallocs, 0 means
+ * that the entry has no deallocator
+ * @param deallocs is the deallocator table
+ * @param dealloc_count is the number of deallocators into the table
+ * @param dealloc_capacity is the capacity of the table
+ * @param length is the number of entries
+ * @param capacity is the number of entries that the arrays can hold
+ */
+typedef struct {
+  Arena *arena; /**< is the arena where the data is stored */
+  void **ptrs; /**< are the pointers to the data */
+  size_t *sizes; /**< are the sizes of the data */
+  uint16_t *dealloc_ids; /**< are the indexes into Ptr_stack_soa::deallocs */
+  void (**deallocs)(Dyn_ptr *); /**< is the deallocator table */
+  uint16_t dealloc_count; /**< is the number of deallocators into the table */
+  uint16_t dealloc_capacity; /**< is the capacity of the table */
+  size_t length; /**< is the number of entries */
+  size_t capacity; /**< is the number of entries that the arrays can hold */
+} Ptr_stack_soa;
+
+/**
+ * @ingroup ptr_stack_soa
+ * @fn Ptr_stack_soa *create_stack_soa(size_t capacity)
+ * @brief It creates a new Ptr_stack_soa instance that is ready for use
+ * @param capacity is the initial capacity of the stack
+ */
+CSM_API Ptr_stack_soa *create_stack_soa(size_t capacity);
+
+/**
+ * @ingroup ptr_stack_soa
+ * @fn size_t stack_soa_new_ptr(Ptr_stack_soa *stack, const void *data, size_t size)
+ * @brief It copies data into the arena and adds a entry for it
+ * @param stack the Ptr_stack_soa
+ * @param data is the data that is gonna be copied, if it is NULL the data is
+ * left uninitialized
+ * @param size is the size of the data
+ * @return the index of the entry or SIZE_MAX if there is no memory or size is 0
+ * @note the data can move when the arena grows, keep the index and not the
+ * raw address
+ */
+CSM_API size_t stack_soa_new_ptr(Ptr_stack_soa *stack, const void *data, size_t size);
+
+/**
+ * @ingroup ptr_stack_soa
+ * @fn void *stack_soa_data(Ptr_stack_soa *stack, size_t index)
+ * @brief It returns the data of a entry
+ * @param stack the Ptr_stack_soa
+ * @param index is the index of the entry
+ * @return the data or NULL if index is out of range
+ */
+CSM_API void *stack_soa_data(Ptr_stack_soa *stack, size_t index);
+
+/**
+ * @ingroup ptr_stack_soa
+ * @fn size_t stack_soa_total_size(const Ptr_stack_soa *stack)
+ * @brief It returns the sum of the sizes of all entries
+ * @param stack the Ptr_stack_soa
+ */
+CSM_API size_t stack_soa_total_size(const Ptr_stack_soa *stack);
+
+/**
+ * @ingroup ptr_stack_soa
+ * @fn bool stack_soa_insert_deallocator(Ptr_stack_soa *stack, size_t index, void (*dealloc)(Dyn_ptr *))
+ * @brief It insert a deallocator into a entry, stack_soa_free calls it with
+ * a Dyn_ptr that has the pointer and the size of the entry
+ * @param stack the Ptr_stack_soa
+ * @param index is the index of the entry
+ * @param dealloc is the deallocator, NULL removes it
+ * @return false if index is out of range or there are too much deallocators
+ */
+CSM_API bool stack_soa_insert_deallocator(Ptr_stack_soa *stack, size_t index,
+                                          void (*dealloc)(Dyn_ptr *));
+
+/**
+ * @ingroup ptr_stack_soa
+ * @fn void stack_soa_free(Ptr_stack_soa *stack)
+ * @brief It free the Ptr_stack_soa, only the entries with a deallocator are
+ * visited
+ * @param stack is the Ptr_stack_soa that is gonna be freed
+ */
+CSM_API void stack_soa_free(Ptr_stack_soa *stack);
+
+#ifdef CSM_POSIX
+/**
+ * @ingroup ptr_stack
+ * @enum Restore_mode
+ * @brief It says how stack_restore maps the arena block of a snapshot
+ */
+typedef enum {
+  CSM_RESTORE_READ_ONLY = 0, /**< the block is mapped read only and shared with the file, zero-copy */
+  CSM_RESTORE_COPY_ON_WRITE, /**< the block is mapped private, pages are copied when they are written */
+} Restore_mode;
+
+/**
+ * @ingroup ptr_stack
+
+ * @fn bool stack_snapshot(Ptr_stack *stack, int fd)
+ * @brief It writes the arena block and the Ptr_stack::ptr_list metadata into
+ * fd, the format is a header, one offset and size pair per Dyn_ptr and the
+ * arena block starting at a page aligned position
+ * @param stack is the Ptr_stack that is gonna be written
+ * @param fd is a seekable file descriptor open for writing, the snapshot is
+ * written from offset 0 with pwrite whatever is the position of fd, because
+ * stack_restore reads it from there
+ * @return false if a write failed or a Dyn_ptr does not live into the arena,
+ * the Dyn_ptr's of stack_new_file_ptr do not count
+ * @note deallocators are not written, restored Dyn_ptr's use null_deallocator,
+ * the Dyn_ptr's of stack_new_file_ptr are skipped, mapped or not, they are
+ * restored as empty Dyn_ptr's(NULL data and size 0) so the indexes are kept
+ */
+CSM_API bool stack_snapshot(Ptr_stack *stack, int fd);
+
+/**
+ * @ingroup ptr_stack
+
+ * @fn Ptr_stack *stack_restore(int fd, Restore_mode mode)
+ * @brief It restores a Ptr_stack written by stack_snapshot, the arena block is
+ * mapped from the file instead of being read
+ * @param fd is a file descriptor of the snapshot, it must be seekable and it
+ * can be closed after stack_restore returns
+ * @param mode is how the block is mapped
+ * @return the restored Ptr_stack or NULL if the snapshot is invalid or
+ * truncated, the arena of it is full and can not grow so new allocations fail
+ */
+CSM_API Ptr_stack *stack_restore(int fd, Restore_mode mode);
+
+/**
+ * @ingroup ptr_stack
+ * @struct Stack_range
+ * @brief A range of Ptr_stack::ptr_list
+ * @param start is the index of the first Dyn_ptr
+ * @param count is the number of Dyn_ptr's
+ */
+typedef struct {
+  size_t start; /**< is the index of the first Dyn_ptr */
+  size_t count; /**< is the number of Dyn_ptr's */
+} Stack_range;
+
+/**
+ * @ingroup ptr_stack
+
+ * @fn ssize_t stack_writev(Ptr_stack *stack, int fd, Stack_range range)
+ * @brief It writes the data of a range of Dyn_ptr's into fd with writev, the
+ * iovec's are built straight from Ptr_stack::ptr_list in batches of IOV_MAX
+ * @param stack is the Ptr_stack
+ * @param fd is a file descriptor open for writing, like a socket or a file
+ * @param range is the range of Ptr_stack::ptr_list that is gonna be written,
+ * it is clamped to Ptr_stack::length and empty Dyn_ptr's are skipped
+ * @return the number of bytes written or -1 if writev failed, errno is kept
+ */
+CSM_API ssize_t stack_writev(Ptr_stack *stack, int fd, Stack_range range);
+
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn Dyn_ptr *stack_read_fd(Ptr_stack *stack, int fd, size_t size)
+ * @brief It reads up to size bytes from fd straight into a new Dyn_ptr, it
+ * keeps reading until size bytes arrive or the end of file
+ * @param stack the Ptr_stack
+ * @param fd is a file descriptor open for reading
+ * @param size is the maximum number of bytes
+ * @return the Dyn_ptr whose size is the number of bytes read, or NULL if
+ * there is no memory, read failed(errno is kept) or the end of file was
+ * reached before any byte
+ */
+CSM_API Dyn_ptr *stack_read_fd(Ptr_stack *stack, int fd, size_t size);
+
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn Dyn_ptr *stack_pread_fd(Ptr_stack *stack, int fd, size_t size, off_t offset)
+ * @brief It is like stack_read_fd but it reads at offset with pread and it
+ * does not move the file position
+ * @param stack the Ptr_stack
+ * @param fd is a file descriptor open for reading
+ * @param size is the maximum number of bytes
+ * @param offset is the position into the file
+ * @return the Dyn_ptr or NULL like stack_read_fd
+ */
+CSM_API Dyn_ptr *stack_pread_fd(Ptr_stack *stack, int fd, size_t size, off_t offset);
+
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn ssize_t stack_read_stream(Ptr_stack *stack, int fd, size_t chunk_size, bool (*on_chunk)(Dyn_ptr *chunk, void *arg), void *arg)
+ * @brief It reads fd until the end of file, every read goes into freshly
+ * bumped arena space and becomes a Dyn_ptr, the unused tail of each chunk is
+ * given back so the chunks stay packed into the arena
+ * @param stack the Ptr_stack
+ * @param fd is a file descriptor open for reading, like a pipe or a socket
+ * @param chunk_size is the maximum size of each read
+ * @param on_chunk is called with every chunk, if it returns false the reading
+ * stops, it can be NULL
+ * @param arg is passed as is to on_chunk
+ * @return the total number of bytes read or -1 if read failed(errno is kept)
+ * or there is no memory
+ */
+CSM_API ssize_t stack_read_stream(Ptr_stack *stack, int fd, size_t chunk_size,
+                                  bool (*on_chunk)(Dyn_ptr *chunk, void *arg),
+                                  void *arg);
+
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn Dyn_ptr *stack_new_file_ptr(Ptr_stack *stack, int fd, off_t offset, size_t size)
+ * @brief It creates a Dyn_ptr for a region of a file that is mapped read only
+ * on the first access through dyn_ptr_map, so only the touched pages are
+ * resident, the mapping is released in stack_free
+ * @param stack the Ptr_stack
+ * @param fd is a file descriptor open for reading, it is duplicated so the
+ * caller can close it
+ * @param offset is the start of the region into the file
+ * @param size is the size of the region
+ * @return the Dyn_ptr or NULL, until it is mapped Dyn_ptr::size is 0 and
+ * Dyn_ptr::ptr must not be used
+ * @note stack_snapshot skips it, it is restored as a empty Dyn_ptr
+ */
+CSM_API Dyn_ptr *stack_new_file_ptr(Ptr_stack *stack, int fd, off_t offset, size_t size);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn void *dyn_ptr_map(Dyn_ptr *dyn_ptr)
+ * @brief It gets the data of a file Dyn_ptr, the region is mapped the first
+ * time, for other Dyn_ptr's it just returns Dyn_ptr::ptr
+ * @param dyn_ptr is the Dyn_ptr
+ * @return the data or NULL if the mapping failed
+ */
+CSM_API void *dyn_ptr_map(Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @def get_dyn_file_data(T, dyn_ptr)
+ * @brief it maps a file Dyn_ptr if it is needed and it returns its data as T
  * @param T is the type to what Dyn_ptr data is gonna transform
  * @param dyn_ptr is the Dyn_ptr where data is gonna be accessed
  */
-#define get_dyn_ptr_data(T, dyn_ptr) (T *)(dyn_ptr->ptr)
+#define get_dyn_file_data(T, dyn_ptr) ((T *)dyn_ptr_map(dyn_ptr))
 
-void stack_free(Ptr_stack *stack) {
-  for (size_t i = 0; i < stack->length; i++) {
-    stack->ptr_list[i].dealloc(&stack->ptr_list[i]);
-  }
+/**
+ * @ingroup ptr_stack
+ * @fn void stack_free_parallel(Ptr_stack *stack, unsigned threads)
+ * @brief It is like stack_free but the deallocators run into threads, it is
+ * for stacks with millions of Dyn_ptr's whose deallocators are slow
+ * @param stack is the Ptr_stack that is gonna be freed
+ * @param threads is the number of threads including the caller one, with 1 or
+ * less it is the same as stack_free
+ * @note the deallocators must be thread safe, they are not in LIFO order
+ * except between the ranges set by stack_free_barrier, the arena is freed
+ * one time at the end, link with -pthread
+ */
+CSM_API void stack_free_parallel(Ptr_stack *stack, unsigned threads);
 
-  free(stack->ptr_list);
-  arena_free(stack->arena);
-  free(stack);
+/**
+ * @ingroup ptr_stack
+ * @fn bool stack_free_step_timed(Ptr_stack *stack, uint64_t budget_ns)
+ * @brief It is like stack_free_step but it runs deallocators until budget_ns
+ * nanoseconds of CLOCK_MONOTONIC are spent
+ * @param stack is the Ptr_stack that is gonna be freed
+ * @param budget_ns is the time that this call can spend, the clock is read
+ * every 64 deallocators so a slow one can pass the budget
+ * @return true if the Ptr_stack was freed, false if it must be called again
+ */
+CSM_API bool stack_free_step_timed(Ptr_stack *stack, uint64_t budget_ns);
+
+#ifdef CSM_ATOMICS
+/**
+ * @ingroup arena
+ * @fn Arena *create_shared_arena(int fd, size_t capacity)
+ * @brief It creates a arena over a shared memory file, the bump pointer lives
+ * into the shared header so many processes can allocate at the same time
+ * @param fd is a file descriptor from memfd_create or shm_open, it is resized
+ * to fit the header and the capacity
+ * @param capacity is the capacity of the arena, it can not grow later
+ * @return the arena or NULL if the file can not be resized or mapped
+ * @note use Dyn_off_ptr's into shared arenas because every process maps the
+ * block at other address
+ */
+CSM_API Arena *create_shared_arena(int fd, size_t capacity);
+
+/**
+ * @ingroup arena
+ * @fn Arena *attach_shared_arena(int fd, bool read_only)
+ * @brief It maps a arena created by create_shared_arena in other process
+ * @param fd is the file descriptor of the shared memory
+ * @param read_only if it is true the block is mapped read only and every
+ * allocation fails
+ * @return the arena or NULL if fd does not hold a shared arena
+ */
+CSM_API Arena *attach_shared_arena(int fd, bool read_only);
+
+/**
+ * @ingroup arena
+ * @fn void shared_arena_set_root(Arena *arena, Dyn_off_ptr root)
+ * @brief It publishes a Dyn_off_ptr for the other processes, everything
+ * written into the arena before this call is visible for who reads the root
+ * @param arena is a writable shared arena
+ * @param root is the Dyn_off_ptr that is gonna be published
+ * @return false if there is no space for the root record
+ */
+CSM_API bool shared_arena_set_root(Arena *arena, Dyn_off_ptr root);
+
+/**
+ * @ingroup arena
+ * @fn Dyn_off_ptr shared_arena_root(const Arena *arena)
+ * @brief It gets the last Dyn_off_ptr published with shared_arena_set_root
+ * @param arena is a shared arena
+ * @return the root, the size is 0 if nothing was published
+ */
+CSM_API Dyn_off_ptr shared_arena_root(const Arena *arena);
+
+/**
+ * @ingroup arena
+ * @fn size_t shared_arena_used(const Arena *arena)
+ * @brief It gets how many bytes of the shared arena are allocated by all the
+ * processes
+ * @param arena is a shared arena
+ */
+CSM_API size_t shared_arena_used(const Arena *arena);
+
+#ifndef CSM_CACHE_LINE
+#define CSM_CACHE_LINE 64 // the padding between fields written by other threads
+#endif
+
+/**
+ * @ingroup ptr_stack
+ * @brief It is a slot of Csm_ring
+ */
+typedef struct {
+  size_t sequence; /**< tells if the slot is free or full for a position */
+  uintptr_t value; /**< is the queued value */
+} Csm_ring_slot;
+
+/**
+ * @ingroup ptr_stack
+ * @struct Csm_ring
+ * @brief A bounded lock free queue that many threads can push and pop, it is
+ * used by Stack_reclaimer
+ */
+typedef struct Csm_ring {
+  Csm_ring_slot *slots; /**< are the slots, a power of 2 of them */
+  size_t mask; /**< is the number of slots minus 1 */
+  char pad0[CSM_CACHE_LINE];
+  size_t enqueue_pos; /**< is the next position that is gonna be filled */
+  char pad1[CSM_CACHE_LINE - sizeof(size_t)];
+  size_t dequeue_pos; /**< is the next position that is gonna be emptied */
+  char pad2[CSM_CACHE_LINE - sizeof(size_t)];
+} Csm_ring;
+
+/**
+ * @ingroup ptr_stack
+ * @brief It is a release queued by stack_release_ptr_remote, it is allocated
+ * by the thread that queues it and freed by the owner
+ */
+typedef struct Csm_remote_node {
+  struct Csm_remote_node *next; /**< is the release queued before it */
+  uintptr_t value; /**< is the index with its tags */
+} Csm_remote_node;
+
+/**
+ * @ingroup ptr_stack
+ * @struct Csm_remote
+ * @brief A unbounded lock free list of the remote releases of a Ptr_stack,
+ * many threads push into it without waiting and the owner takes the whole
+ * list at once
+ */
+typedef struct Csm_remote {
+  Csm_remote_node *head; /**< is the last queued release or NULL */
+} Csm_remote;
+
+/**
+ * @ingroup ptr_stack
+ * @struct Stack_reclaimer
+ * @brief A background thread that frees the Ptr_stack's given by
+ * stack_free_async, they are passed by a Csm_ring
+ */
+typedef struct {
+  Csm_ring ring; /**< is the queue of Ptr_stack's */
+  bool stop; /**< tells the thread to finish when the queue is empty */
+  pthread_t thread; /**< is the reclaimer thread */
+  pthread_mutex_t lock; /**< is only taken to sleep or to wake a sleeper */
+  pthread_cond_t ready; /**< wakes the reclaimer thread when the queue is not empty or on stop */
+  pthread_cond_t space; /**< wakes the producers when the queue is not full */
+  bool sleeping; /**< tells if the reclaimer thread waits on Stack_reclaimer::ready */
+  size_t blocked; /**< is the number of producers that wait on Stack_reclaimer::space */
+} Stack_reclaimer;
+
+/**
+ * @ingroup ptr_stack
+ * @fn Stack_reclaimer *create_reclaimer(size_t depth)
+ * @brief It creates a Stack_reclaimer and it starts its thread
+ * @param depth is the most Ptr_stack's that can wait into the queue, it is
+ * rounded up to a power of 2
+ * @return the Stack_reclaimer or NULL if there is no memory or no thread
+ */
+CSM_API Stack_reclaimer *create_reclaimer(size_t depth);
+
+/**
+ * @ingroup ptr_stack
+ * @fn void stack_free_async(Stack_reclaimer *reclaimer, Ptr_stack *stack)
+ * @brief It gives the Ptr_stack to the reclaimer thread that calls stack_free
+ * on it, it returns at once unless the queue is full, then it sleeps until the
+ * reclaimer takes a Ptr_stack, the reclaimer thread sleeps too while the
+ * queue is empty
+ * @param reclaimer is the Stack_reclaimer, if it is NULL stack_free is called
+ * @param stack is the Ptr_stack that is gonna be freed
+ * @note the deallocators run into the reclaimer thread, it can be called from
+ * many threads at once
+ */
+CSM_API void stack_free_async(Stack_reclaimer *reclaimer, Ptr_stack *stack);
+
+/**
+ * @ingroup ptr_stack
+ * @fn void reclaimer_free(Stack_reclaimer *reclaimer)
+ * @brief It waits until all the queued Ptr_stack's are freed and it stops
+ * the reclaimer thread
+ * @param reclaimer is the Stack_reclaimer that is gonna be freed
+ */
+CSM_API void reclaimer_free(Stack_reclaimer *reclaimer);
+
+/**
+ * @ingroup ptr_stack
+ * @fn bool stack_enable_remote_free(Ptr_stack *stack, size_t depth)
+ * @brief It creates the queue that lets other threads release the Dyn_ptr's
+ * of the Ptr_stack, the owner thread drains it on its next allocation
+ * @param stack the Ptr_stack, it must be called by the owner thread
+ * @param depth is not used, the queue has no bound
+ * @return false if there is no memory
+ */
+CSM_API bool stack_enable_remote_free(Ptr_stack *stack, size_t depth);
+
+/**
+ * @ingroup ptr_stack
+ * @fn bool stack_release_ptr_remote(Ptr_stack *stack, size_t index)
+ * @brief It is stack_release_ptr for threads that do not own the Ptr_stack,
+ * the release is queued without a lock or a wait and the owner thread does it
+ * @param stack the Ptr_stack, stack_enable_remote_free must be called first
+ * @param index is the index of the Dyn_ptr into Ptr_stack::ptr_list, a index
+ * is used because the owner can move the list at any moment
+ * @return false if stack_enable_remote_free was not called or if there is no
+ * memory for the node of the queue
+ * @note the top 2 bits of index are kept for the rc releases
+ */
+CSM_API bool stack_release_ptr_remote(Ptr_stack *stack, size_t index);
+
+/**
+ * @ingroup ptr_stack
+ * @fn void stack_drain_remote(Ptr_stack *stack)
+ * @brief It does the releases queued by stack_release_ptr_remote in the
+ * order they were queued, every function that adds a Dyn_ptr or a block to
+ * the stack does it too so it is only needed when the owner stops allocating
+ * @param stack the Ptr_stack, it must be called by the owner thread
+ */
+CSM_API void stack_drain_remote(Ptr_stack *stack);
+
+/**
+ * @ingroup ptr_stack
+ * @brief It is the slot of a reader thread of Stack_epoch, each one has its
+ * own cache line
+ */
+typedef struct {
+  size_t epoch; /**< is the epoch where the reader entered or 0 if it is outside */
+  char pad[CSM_CACHE_LINE - sizeof(size_t)];
+} Epoch_reader;
+
+/**
+ * @ingroup ptr_stack
+ * @brief It is a Dyn_ptr retired into a Stack_epoch
+ */
+typedef struct {
+  size_t index; /**< is the index of the Dyn_ptr into Ptr_stack::ptr_list */
+  size_t epoch; /**< is the epoch where it was retired */
+} Epoch_retired;
+
+/**
+ * @ingroup ptr_stack
+ * @struct Stack_epoch
+ * @brief Epoch based reclamation for a Ptr_stack that is read by many
+ * threads while the owner thread replaces its data, the readers do not take
+ * locks nor counters and the retired Dyn_ptr's are released when every reader
+ * left the epochs where it could see them
+ */
+typedef struct Stack_epoch {
+  Ptr_stack *stack; /**< is the Ptr_stack, only the owner thread writes it */
+  size_t global; /**< is the current epoch, it starts at 1 */
+  char pad[CSM_CACHE_LINE - sizeof(size_t)];
+  Epoch_reader *readers; /**< are the slots of the readers */
+  unsigned reader_count; /**< is the number of Stack_epoch::readers */
+  Epoch_retired *retired; /**< are the retired Dyn_ptr's in epoch order */
+  size_t retired_count; /**< is the number of Stack_epoch::retired */
+  size_t retired_capacity; /**< is the capacity of Stack_epoch::retired */
+} Stack_epoch;
+
+/**
+ * @ingroup ptr_stack
+ * @fn Stack_epoch *create_epoch(Ptr_stack *stack, unsigned readers)
+ * @brief It creates a Stack_epoch for the Ptr_stack
+ * @param stack the Ptr_stack, it must be created big enough so its arena and
+ * Ptr_stack::ptr_list do not grow while there are readers, growing moves them
+ * and the readers hold raw pointers into them, the builds without NDEBUG
+ * assert it when the stack grows
+ * @param readers is the number of reader threads, each one uses a id from 0
+ * to readers - 1
+ * @return the Stack_epoch or NULL if there is no memory or if the stack
+ * already has one
+ */
+CSM_API Stack_epoch *create_epoch(Ptr_stack *stack, unsigned readers);
+
+/**
+ * @ingroup ptr_stack
+ * @fn void epoch_enter(Stack_epoch *epoch, unsigned reader)
+ * @brief It starts a read section, the Dyn_ptr's reached inside it are not
+ * released until epoch_exit
+ * @param epoch the Stack_epoch
+ * @param reader is the id of the calling thread, two threads must not share it
+ */
+CSM_API void epoch_enter(Stack_epoch *epoch, unsigned reader);
+
+/**
+ * @ingroup ptr_stack
+ * @fn void epoch_exit(Stack_epoch *epoch, unsigned reader)
+ * @brief It ends the read section started by epoch_enter
+ * @param epoch the Stack_epoch
+ * @param reader is the id given to epoch_enter
+ */
+CSM_API void epoch_exit(Stack_epoch *epoch, unsigned reader);
+
+/**
+ * @ingroup ptr_stack
+ * @fn bool epoch_retire(Stack_epoch *epoch, size_t index)
+ * @brief It schedules the release of a Dyn_ptr that the readers can not reach
+ * anymore, it is done by epoch_collect with stack_release_ptr
+ * @param epoch the Stack_epoch, it must be called by the owner thread
+ * @param index is the index of the Dyn_ptr into Ptr_stack::ptr_list, it must
+ * be unlinked from the shared structures before this call
+ * @return false if there is no memory
+ */
+CSM_API bool epoch_retire(Stack_epoch *epoch, size_t index);
+
+/**
+ * @ingroup ptr_stack
+ * @fn size_t epoch_collect(Stack_epoch *epoch)
+ * @brief It advances the epoch if every reader inside a read section is into
+ * the current one and it releases the Dyn_ptr's retired two epochs ago or more
+ * @param epoch the Stack_epoch, it must be called by the owner thread
+ * @return the number of released Dyn_ptr's
+ */
+CSM_API size_t epoch_collect(Stack_epoch *epoch);
+
+/**
+ * @ingroup ptr_stack
+ * @fn void epoch_free(Stack_epoch *epoch)
+ * @brief It waits until every retired Dyn_ptr is released and it frees the
+ * Stack_epoch, the Ptr_stack is kept
+ * @param epoch the Stack_epoch, it must be called by the owner thread
+ * @note a reader that never calls epoch_exit makes it wait forever
+ */
+CSM_API void epoch_free(Stack_epoch *epoch);
+
+/**
+ * @ingroup dyn_ptr
+ * @brief It is the header that is just before the data of a reference
+ * counted Dyn_ptr, the counts are atomic
+ */
+typedef struct {
+  size_t strong; /**< is the number of owners of the data */
+  size_t weak; /**< is the number of weak references plus 1 while strong is not 0 */
+  size_t anchor; /**< is 1 plus the index of the released Dyn_ptr that keeps the deallocator or 0 */
+} Rc_header;
+
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn Dyn_ptr *stack_new_rc(Ptr_stack *stack, void *data, size_t size)
+ * @brief It creates a reference counted Dyn_ptr, the caller gets the first
+ * strong reference
+ * @param stack the Ptr_stack
+ * @param data is the data that is gonna be copied, if it is NULL the data is
+ * left uninitialized
+ * @param size is the size of the data
+ * @return the Dyn_ptr or NULL if there is no memory or size is 0
+ * @note the Rc_header lives into the arena just before Dyn_ptr::ptr, when the
+ * last strong reference goes the deallocator runs and when the last weak one
+ * goes the block returns to the free lists of the Ptr_stack
+ */
+CSM_API Dyn_ptr *stack_new_rc(Ptr_stack *stack, void *data, size_t size);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn void rc_retain(Dyn_ptr *dyn_ptr)
+ * @brief It adds a strong reference
+ * @param dyn_ptr is a Dyn_ptr from stack_new_rc that has a strong reference
+ */
+CSM_API void rc_retain(Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn bool rc_release(Ptr_stack *stack, Dyn_ptr *dyn_ptr)
+ * @brief It drops a strong reference, the last one runs the deallocator
+ * @param stack the Ptr_stack of the Dyn_ptr
+ * @param dyn_ptr is a Dyn_ptr from stack_new_rc
+ * @return true if it was the last strong reference, false if it was not or
+ * if dyn_ptr does not hold a strong reference
+ * @note dyn_ptr keeps its data for its weak references but after the call
+ * it can not be used with stack_cow_clone, dyn_ptr_mut or rc_release,
+ * without stack_enable_remote_free it must be called by the owner
+ * thread, with it the last release only queues the index and the deallocator
+ * runs on the owner thread at its next drain, so other threads can call it
+ * while the owner does not grow Ptr_stack::ptr_list, like with Stack_epoch
+ */
+CSM_API bool rc_release(Ptr_stack *stack, Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn void rc_weak_retain(Dyn_ptr *dyn_ptr)
+ * @brief It adds a weak reference, it keeps the Rc_header but not the data
+ * @param dyn_ptr is a Dyn_ptr from stack_new_rc that has a strong reference
+ */
+CSM_API void rc_weak_retain(Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn bool rc_upgrade(Dyn_ptr *dyn_ptr)
+ * @brief It turns a weak reference into a new strong one if the data is alive
+ * @param dyn_ptr is a Dyn_ptr from stack_new_rc that has a weak reference
+ * @return false if the last strong reference already went, the weak
+ * reference is kept in both cases
+ */
+CSM_API bool rc_upgrade(Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn void rc_weak_release(Ptr_stack *stack, Dyn_ptr *dyn_ptr)
+ * @brief It drops a weak reference
+ * @param stack the Ptr_stack of the Dyn_ptr
+ * @param dyn_ptr is a Dyn_ptr from stack_new_rc
+ * @note the thread rules of rc_release apply, the block is given back by the
+ * owner thread
+ */
+CSM_API void rc_weak_release(Ptr_stack *stack, Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn size_t rc_strong_count(const Dyn_ptr *dyn_ptr)
+ * @brief It gets the number of strong references, the value can be old when
+ * other threads use the Dyn_ptr
+ * @param dyn_ptr is a Dyn_ptr from stack_new_rc
+ */
+CSM_API size_t rc_strong_count(const Dyn_ptr *dyn_ptr);
+
+/**
+ * @addtogroup ptr_stack
+ * @addtogroup dyn_ptr
+
+ * @fn Dyn_ptr *stack_cow_clone(Ptr_stack *stack, Dyn_ptr *source)
+ * @brief It creates a Dyn_ptr that shares the block of source until one of
+ * them is written through dyn_ptr_mut, so nothing is copied for clones that
+ * are only read
+ * @param stack the Ptr_stack
+ * @param source is a Dyn_ptr of the stack from stack_new_rc or stack_cow_clone
+ * @return the clone, it holds a strong reference, or NULL if
+ * Ptr_stack::ptr_list can not grow or if source is not a Dyn_ptr of the stack
+ * that holds a strong reference, pointers to other Dyn_ptr's can be moved
+ * like with stack_new_ptr
+ * @note the clone has no deallocator, the deallocator of source is the one of
+ * the block and it runs when the last Dyn_ptr that shares the block is
+ * released, whatever is the order of the releases, only one of them can have
+ * a deallocator
+ */
+CSM_API Dyn_ptr *stack_cow_clone(Ptr_stack *stack, Dyn_ptr *source);
+
+/**
+ * @ingroup dyn_ptr
+ * @fn void *dyn_ptr_mut(Ptr_stack *stack, Dyn_ptr *dyn_ptr)
+ * @brief It gets the data of a shared Dyn_ptr for writing, if other Dyn_ptr's
+ * share the block the data is copied first into a new block
+ * @param stack the Ptr_stack, it must be called by the owner thread
+ * @param dyn_ptr is a Dyn_ptr of the stack from stack_new_rc or stack_cow_clone
+ * @return the data or NULL if there is no memory for the copy or if dyn_ptr is
+ * not a Dyn_ptr of the stack that holds a strong reference
+ * @note the data from get_dyn_ptr_data must not be written for these Dyn_ptr's,
+ * the deallocator of dyn_ptr goes with it to the copy
+ */
+CSM_API void *dyn_ptr_mut(Ptr_stack *stack, Dyn_ptr *dyn_ptr);
+
+/**
+ * @ingroup dyn_ptr
+ * @def get_dyn_ptr_mut(T, stack, dyn_ptr)
+ * @brief it gets the data of a shared Dyn_ptr for writing as T
+ * @param T is the type to what Dyn_ptr data is gonna transform
+ * @param stack is the Ptr_stack of the Dyn_ptr
+ * @param dyn_ptr is the Dyn_ptr where data is gonna be written
+ */
+#define get_dyn_ptr_mut(T, stack, dyn_ptr) ((T *)dyn_ptr_mut(stack, dyn_ptr))
+
+#if defined(CSM_IO_URING) && defined(__linux__)
+/**\defgroup uring io_uring integration, define CSM_IO_URING to enable it,
+ * with -std=c99 or -std=c11 _GNU_SOURCE or _DEFAULT_SOURCE must be defined too */
+
+/**
+ * @ingroup uring
+ * @struct Uring
+ * @brief A io_uring instance whose fixed buffer is the block of a Arena, it
+ * uses the raw syscalls so liburing is not needed
+ */
+typedef struct {
+  int fd; /**< is the io_uring file descriptor */
+  unsigned *sq_head; /**< is the head of the submission ring */
+  unsigned *sq_tail; /**< is the tail of the submission ring */
+  unsigned sq_mask; /**< is the mask of the submission ring */
+  unsigned sq_entries; /**< is the size of the submission ring */
+  unsigned *sq_array; /**< is the index array of the submission ring */
+  struct io_uring_sqe *sqes; /**< are the submission entries */
+  unsigned *cq_head; /**< is the head of the completion ring */
+  unsigned *cq_tail; /**< is the tail of the completion ring */
+  unsigned cq_mask; /**< is the mask of the completion ring */
+  struct io_uring_cqe *cqes; /**< are the completion entries */
+  void *sq_ring; /**< is the mmap of the submission ring */
+  size_t sq_ring_size; /**< is the size of Uring::sq_ring */
+  void *cq_ring; /**< is the mmap of the completion ring, it can be Uring::sq_ring */
+  size_t cq_ring_size; /**< is the size of Uring::cq_ring */
+  size_t sqes_size; /**< is the size of Uring::sqes */
+  unsigned to_submit; /**< is the number of entries that the kernel did not see yet */
+  unsigned in_flight; /**< is the number of entries without completion */
+  uint8_t *buffer; /**< is the registered block or NULL */
+  size_t buffer_size; /**< is the size of Uring::buffer */
+} Uring;
+
+/**
+ * @ingroup uring
+ * @fn Uring *create_uring(unsigned entries)
+ * @brief It creates a io_uring instance
+ * @param entries is the size of the submission ring, a power of two
+ * @return the Uring or NULL if io_uring is not available
+ */
+CSM_API Uring *create_uring(unsigned entries);
+
+/**
+ * @ingroup uring
+ * @fn bool uring_register_arena(Uring *ring, Arena *arena)
+ * @brief It registers the whole block of the arena as the fixed buffer of the
+ * ring, so reads into it do not pin pages on every operation
+ * @param ring is the Uring
+ * @param arena is a heap arena
+ * @return false if the kernel refused the buffer or there are reads in flight
+ * @note if the arena grows its block moves, uring_read registers it again
+ */
+CSM_API bool uring_register_arena(Uring *ring, Arena *arena);
+
+/**
+ * @ingroup uring
+ * @fn Dyn_ptr *uring_read(Uring *ring, Ptr_stack *stack, int fd, size_t size, uint64_t offset)
+ * @brief It creates a uninitialized Dyn_ptr and it queues a fixed buffer read
+ * of fd into it, the read starts with uring_submit_and_wait
+ * @param ring is the Uring
+ * @param stack is the Ptr_stack, its arena is registered if it is needed
+ * @param fd is a file descriptor open for reading
+ * @param size is the number of bytes, up to UINT32_MAX
+ * @param offset is the position into the file
+ * @return the Dyn_ptr, its data is valid after the completion, or NULL if
+ * there is no memory, the ring is full or the arena would need to grow while
+ * other reads are in flight
+ * @warning while reads are in flight nothing else must allocate from stack
+ * (stack_new_ptr, stack_alloc_uninit...), only uring_read checks the room of
+ * the arena, other allocations can grow it and move the registered block, then
+ * the kernel writes into the freed one
+ */
+CSM_API Dyn_ptr *uring_read(Uring *ring, Ptr_stack *stack, int fd, size_t size,
+                            uint64_t offset);
+
+/**
+ * @ingroup uring
+ * @fn int uring_submit_and_wait(Uring *ring, Ptr_stack *stack, unsigned wait_nr)
+ * @brief It submits the queued reads and it reaps the completions, every
+ * Dyn_ptr gets the number of bytes read as size(0 if the read failed)
+ * @param ring is the Uring
+ * @param stack is the Ptr_stack used with uring_read
+ * @param wait_nr is the minimum number of completions to wait for
+ * @return the number of reaped completions or a negative errno
+ */
+CSM_API int uring_submit_and_wait(Uring *ring, Ptr_stack *stack, unsigned wait_nr);
+
+/**
+ * @ingroup uring
+ * @fn void uring_free(Uring *ring)
+ * @brief It closes the io_uring instance and it frees the Uring
+ * @param ring is the Uring
+ */
+CSM_API void uring_free(Uring *ring);
+#endif // CSM_IO_URING
+#endif // CSM_ATOMICS
+#endif // CSM_POSIX
+
+#ifdef CSM_IMPLEMENTATION
+#if defined(CSM_POSIX) && defined(CSM_ATOMICS)
+#define CSM_SHARED_ARENA_MAGIC 0x41534d43u // "CMSA"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t header_size;
+  uint64_t capacity;
+  uint64_t used; // atomic bump pointer
+  uint64_t root; // atomic, offset of the root record plus one
+  uint8_t padding[32];
+} Shared_arena_header;
+
+static Arena_ptr __csm_internal_shared_alloc(Arena *arena, size_t size, size_t align) {
+  if (arena->kind != CSM_ARENA_SHARED)
+    return (Arena_ptr){.size = 0, .block = NULL};
+
+  Shared_arena_header *header = (Shared_arena_header *)arena->mapping;
+  uint64_t used = __atomic_load_n(&header->used, __ATOMIC_RELAXED);
+  uint64_t start;
+  do {
+    start = (used + (align - 1)) & ~(uint64_t)(align - 1);
+    if (start > arena->capacity || size > arena->capacity - start)
+      return (Arena_ptr){.size = 0, .block = NULL};
+  } while (!__atomic_compare_exchange_n(&header->used, &used, start + size, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  arena->actual_size = (size_t)(start + size);
+  return (Arena_ptr){.size = size, .block = arena->block + start};
+}
+#endif
+
+Arena *create_arena(size_t capacity) {
+  Arena *arena = (Arena *)malloc(sizeof(Arena));
+
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  arena->capacity = capacity;
+  arena->actual_size = 0;
+  arena->kind = CSM_ARENA_HEAP;
+  arena->mapping = NULL;
+  arena->mapping_size = 0;
+  arena->block = (uint8_t *)malloc(arena->capacity);
+
+  if (arena->block == NULL) {
+    free(arena);
+    return NULL;
+  }
+
+  return arena;
+}
+
+Arena_ptr arena_alloc(Arena *arena, size_t size) {
+  if (arena == NULL || size == 0)
+    return (Arena_ptr){.size = 0, .block = NULL};
+
+#if defined(CSM_POSIX) && defined(CSM_ATOMICS)
+  if (arena->kind == CSM_ARENA_SHARED || arena->kind == CSM_ARENA_SHARED_READ_ONLY)
+    return __csm_internal_shared_alloc(arena, size, 1);
+#endif
+
+  if (arena->actual_size + size > arena->capacity)
+    return (Arena_ptr){.size = 0, .block = NULL};
+
+  uint8_t *block = &arena->block[arena->actual_size];
+  arena->actual_size += size;
+
+  return (Arena_ptr){.size = size, .block = block};
+}
+
+Arena_ptr arena_alloc_aligned(Arena *arena, size_t size, size_t align) {
+  if (arena == NULL || size == 0)
+    return (Arena_ptr){.size = 0, .block = NULL};
+
+#if defined(CSM_POSIX) && defined(CSM_ATOMICS)
+  if (arena->kind == CSM_ARENA_SHARED || arena->kind == CSM_ARENA_SHARED_READ_ONLY)
+    return __csm_internal_shared_alloc(arena, size, align);
+#endif
+
+  size_t start = (arena->actual_size + (align - 1)) & ~(align - 1);
+  if (start > arena->capacity || size > arena->capacity - start)
+    return (Arena_ptr){.size = 0, .block = NULL};
+
+  arena->actual_size = start;
+  return arena_alloc(arena, size);
+}
+
+bool arena_realloc(Arena *arena, size_t extra_capacity) {
+  if (arena->kind != CSM_ARENA_HEAP)
+    return false;
+  void *ptr = realloc(arena->block, arena->capacity + extra_capacity);
+  if (ptr == NULL)
+    return false;
+  arena->block = (uint8_t *)ptr;
+  arena->capacity += extra_capacity;
+  return true;
+}
+
+void arena_free(Arena *arena) {
+#ifdef CSM_POSIX
+  if (arena->kind != CSM_ARENA_HEAP) {
+    munmap(arena->mapping, arena->mapping_size);
+    free(arena);
+    return;
+  }
+#endif
+  free(arena->block);
+  free(arena);
+}
+
+Arena *arena_clone(const Arena *arena) {
+  Arena *clone = create_arena(arena->capacity);
+  if (clone == NULL)
+    return NULL;
+
+  memcpy(clone->block, arena->block, arena->actual_size);
+  clone->actual_size = arena->actual_size;
+  return clone;
+}
+
+void rel_ptr_set(Rel_ptr *rel, const void *target) {
+  if (target == NULL) {
+    rel->offset = 0;
+    return;
+  }
+  rel->offset = (const uint8_t *)target - (const uint8_t *)rel;
+}
+
+void *rel_ptr_get(const Rel_ptr *rel) {
+  if (rel->offset == 0)
+    return NULL;
+  return (uint8_t *)rel + rel->offset;
+}
+
+Dyn_off_ptr arena_alloc_off(Arena *arena, size_t size) {
+  Arena_ptr arena_ptr = arena_alloc_aligned(arena, size, CSM_ALIGNMENT);
+  if (arena_ptr.block == NULL)
+    return (Dyn_off_ptr){.offset = 0, .size = 0};
+
+  return (Dyn_off_ptr){.offset = (size_t)(arena_ptr.block - arena->block),
+                       .size = size};
+}
+
+bool arena_vec_init(Arena_vec *vec, Arena *arena, size_t elem_size,
+                    size_t capacity) {
+  if (vec == NULL || arena == NULL || elem_size == 0)
+    return false;
+
+  vec->arena = arena;
+  vec->offset = 0;
+  vec->length = 0;
+  vec->capacity = 0;
+  vec->elem_size = elem_size;
+  vec->stack = NULL;
+  return capacity == 0 || arena_vec_reserve(vec, capacity);
+}
+
+static bool __csm_internal_stack_vec_reserve(Arena_vec *vec, size_t capacity);
+
+bool arena_vec_reserve(Arena_vec *vec, size_t capacity) {
+  if (capacity <= vec->capacity)
+    return true;
+  if (capacity > SIZE_MAX / vec->elem_size)
+    return false;
+
+  Arena *arena = vec->arena;
+  size_t old_size = vec->capacity * vec->elem_size;
+  size_t size = capacity * vec->elem_size;
+
+  // the last allocation of a heap arena just moves the bump pointer
+  if (arena->kind == CSM_ARENA_HEAP && vec->capacity > 0 &&
+      vec->offset + old_size == arena->actual_size &&
+      (vec->stack == NULL || arena->capacity - arena->actual_size >= size - old_size)) {
+    size_t extra = size - old_size;
+    if (arena->capacity - arena->actual_size < extra &&
+        !arena_realloc(arena, extra > arena->capacity ? extra : arena->capacity))
+      return false;
+    arena->actual_size += extra;
+    vec->capacity = capacity;
+    return true;
+  }
+  if (vec->stack != NULL)
+    return __csm_internal_stack_vec_reserve(vec, capacity);
+
+  Dyn_off_ptr block = arena_alloc_off(arena, size);
+  if (block.size == 0) {
+    size_t growth = size + CSM_ALIGNMENT;
+    if (growth < arena->capacity) // doubling keeps the copies amortized
+      growth = arena->capacity;
+    if (!arena_realloc(arena, growth))
+      return false;
+    block = arena_alloc_off(arena, size);
+    if (block.size == 0)
+      return false;
+  }
+
+  if (vec->length > 0)
+    memcpy(arena->block + block.offset, arena->block + vec->offset,
+           vec->length * vec->elem_size);
+  vec->offset = block.offset;
+  vec->capacity = capacity;
+  return true;
+}
+
+void *arena_vec_push(Arena_vec *vec) {
+  if (vec->length == vec->capacity &&
+      !arena_vec_reserve(vec, vec->capacity > 0 ? vec->capacity * 2 : 8))
+    return NULL;
+
+  return vec->arena->block + vec->offset + vec->length++ * vec->elem_size;
+}
+
+#ifdef CSM_POSIX
+static void __csm_internal_file_deallocator(Dyn_ptr *dyn_ptr);
+#endif
+
+#ifdef CSM_COMPACT_DYN_PTR
+#define CSM_DEALLOC_NULL 0u // the first ids of every table are fixed
+#define CSM_DEALLOC_FILE 1u
+#endif
+
+#ifdef CSM_POSIX
+// it tells if the Dyn_ptr comes from stack_new_file_ptr, mapped or not
+static bool __csm_internal_is_file_ptr(const Dyn_ptr *dyn_ptr) {
+#ifdef CSM_COMPACT_DYN_PTR
+  return dyn_ptr->dealloc_id == CSM_DEALLOC_FILE;
+#else
+  return dyn_ptr->dealloc == __csm_internal_file_deallocator;
+#endif
+}
+#endif
+
+static bool __csm_internal_stack_init_lists(Ptr_stack *stack) {
+  stack->dtors = NULL;
+  stack->dtor_count = 0;
+  stack->dtor_capacity = 0;
+  stack->dtor_marks = NULL;
+  stack->dtor_mark_words = 0;
+  stack->rc_marks = NULL;
+  stack->rc_mark_words = 0;
+  stack->groups = NULL;
+  stack->group_count = 0;
+  stack->barriers = NULL;
+  stack->barrier_count = 0;
+  for (size_t i = 0; i < CSM_SIZE_CLASSES; i++)
+    stack->free_lists[i] = SIZE_MAX;
+  stack->remote = NULL;
+  stack->epoch = NULL;
+  stack->dedup = (Dyn_off_ptr){.offset = 0, .size = 0};
+  stack->dedup_refs = (Dyn_off_ptr){.offset = 0, .size = 0};
+  stack->dedup_count = 0;
+  stack->dedup_stats = (Dedup_stats){.lookups = 0, .hits = 0, .bytes_saved = 0};
+  stack->interns = (Dyn_off_ptr){.offset = 0, .size = 0};
+  stack->intern_count = 0;
+  stack->intern_chunk = NULL;
+  stack->intern_left = 0;
+  stack->intern_index = 0;
+#ifdef CSM_COMPACT_DYN_PTR
+  stack->deallocs = (void (**)(Dyn_ptr *))malloc(8 * sizeof(*stack->deallocs));
+  if (stack->deallocs == NULL)
+    return false;
+  stack->deallocs[CSM_DEALLOC_NULL] = null_deallocator;
+#ifdef CSM_POSIX
+  stack->deallocs[CSM_DEALLOC_FILE] = __csm_internal_file_deallocator;
+#else
+  stack->deallocs[CSM_DEALLOC_FILE] = null_deallocator;
+#endif
+  stack->dealloc_count = 2;
+  stack->dealloc_capacity = 8;
+#else
+  (void)stack;
+#endif
+  return true;
+}
+
+static void __csm_internal_stack_free_lists(Ptr_stack *stack) {
+#if defined(CSM_POSIX) && defined(CSM_ATOMICS)
+  if (stack->remote != NULL) {
+    // the releases that were not drained are done by the teardown
+    Csm_remote_node *node = stack->remote->head;
+    while (node != NULL) {
+      Csm_remote_node *next = node->next;
+      free(node);
+      node = next;
+    }
+    free(stack->remote);
+  }
+#endif
+  free(stack->barriers);
+  free(stack->groups);
+  free(stack->dtors);
+  free(stack->dtor_marks);
+  free(stack->rc_marks);
+#ifdef CSM_COMPACT_DYN_PTR
+  free(stack->deallocs);
+#endif
+}
+
+#ifdef CSM_COMPACT_DYN_PTR
+#define __csm_internal_set_null_dealloc(dyn_ptr) ((dyn_ptr)->dealloc_id = CSM_DEALLOC_NULL)
+#define __csm_internal_has_dealloc(dyn_ptr) ((dyn_ptr)->dealloc_id != CSM_DEALLOC_NULL)
+#else
+#define __csm_internal_set_null_dealloc(dyn_ptr) ((dyn_ptr)->dealloc = null_deallocator)
+#define __csm_internal_has_dealloc(dyn_ptr) ((dyn_ptr)->dealloc != null_deallocator)
+#endif
+
+#define CSM_WORD_BITS (8 * sizeof(size_t))
+
+// it records the slot into Ptr_stack::dtors the first time, the bit of the
+// slot says if it is already there because the deallocator can be set back
+// to null_deallocator and later to other function
+static bool __csm_internal_mark_dtor(Ptr_stack *stack, size_t index) {
+  size_t word = index / CSM_WORD_BITS;
+  size_t bit = (size_t)1 << (index % CSM_WORD_BITS);
+  if (word >= stack->dtor_mark_words) {
+    size_t words = (stack->capacity + CSM_WORD_BITS - 1) / CSM_WORD_BITS;
+    if (words <= word)
+      words = word + 1;
+    size_t *marks = (size_t *)realloc(stack->dtor_marks, words * sizeof(size_t));
+    if (marks == NULL)
+      return false;
+    memset(marks + stack->dtor_mark_words, 0,
+           (words - stack->dtor_mark_words) * sizeof(size_t));
+    stack->dtor_marks = marks;
+    stack->dtor_mark_words = words;
+  }
+  if (stack->dtor_marks[word] & bit)
+    return true;
+
+  if (stack->dtor_count == stack->dtor_capacity) {
+    size_t capacity = stack->dtor_capacity > 0 ? stack->dtor_capacity * 2 : 16;
+    size_t *dtors = (size_t *)realloc(stack->dtors, capacity * sizeof(size_t));
+    if (dtors == NULL)
+      return false;
+    stack->dtors = dtors;
+    stack->dtor_capacity = capacity;
+  }
+  stack->dtors[stack->dtor_count++] = index;
+  stack->dtor_marks[word] |= bit;
+  return true;
+}
+
+// it sets the deallocator of a Dyn_ptr that already is into Ptr_stack::ptr_list
+// slots, in the compact layout the function is looked up or added into the
+// table of the stack, the first non null deallocator of a slot records its
+// index into Ptr_stack::dtors
+static bool __csm_internal_set_dealloc(Ptr_stack *stack, Dyn_ptr *dyn_ptr,
+                                       void (*dealloc)(Dyn_ptr *)) {
+  if (dealloc == NULL)
+    dealloc = null_deallocator;
+
+  uintptr_t slot = (uintptr_t)dyn_ptr - (uintptr_t)stack->ptr_list;
+  bool owned = slot < stack->capacity * sizeof(Dyn_ptr);
+  if (owned && dealloc != null_deallocator &&
+      !__csm_internal_mark_dtor(stack, slot / sizeof(Dyn_ptr)))
+    return false;
+#ifdef CSM_COMPACT_DYN_PTR
+  uint32_t id = 0;
+  while (id < stack->dealloc_count && stack->deallocs[id] != dealloc)
+    id++;
+
+  if (id == stack->dealloc_count) {
+    if (stack->dealloc_count == stack->dealloc_capacity) {
+      void (**deallocs)(Dyn_ptr *) = (void (**)(Dyn_ptr *))realloc(
+          stack->deallocs, stack->dealloc_capacity * 2 * sizeof(*deallocs));
+      if (deallocs == NULL)
+        return false;
+      stack->deallocs = deallocs;
+      stack->dealloc_capacity *= 2;
+    }
+    stack->deallocs[stack->dealloc_count++] = dealloc;
+  }
+  dyn_ptr->dealloc_id = id;
+#else
+  dyn_ptr->dealloc = dealloc;
+#endif
+  return true;
+}
+
+static void (*__csm_internal_get_dealloc(Ptr_stack *stack, Dyn_ptr *dyn_ptr))(Dyn_ptr *) {
+#ifdef CSM_COMPACT_DYN_PTR
+  return stack->deallocs[dyn_ptr->dealloc_id];
+#else
+  (void)stack;
+  return dyn_ptr->dealloc;
+#endif
+}
+
+// the live stacks with the address range of their Ptr_stack::ptr_list, so
+// dyn_ptr_insert_deallocator finds the stack of a Dyn_ptr
+typedef struct {
+  Ptr_stack *stack;
+  uintptr_t begin;
+  uintptr_t end;
+} __csm_internal_live_stack;
+
+static __csm_internal_live_stack *__csm_internal_live_stacks = NULL;
+static size_t __csm_internal_live_count = 0;
+static size_t __csm_internal_live_capacity = 0;
+#ifdef CSM_POSIX
+static pthread_mutex_t __csm_internal_live_lock = PTHREAD_MUTEX_INITIALIZER;
+#define __csm_internal_live_enter() pthread_mutex_lock(&__csm_internal_live_lock)
+#define __csm_internal_live_exit() pthread_mutex_unlock(&__csm_internal_live_lock)
+#else
+#define __csm_internal_live_enter() ((void)0)
+#define __csm_internal_live_exit() ((void)0)
+#endif
+
+static void __csm_internal_live_remove(Ptr_stack *stack) {
+  __csm_internal_live_enter();
+  for (size_t i = 0; i < __csm_internal_live_count; i++) {
+    if (__csm_internal_live_stacks[i].stack == stack) {
+      __csm_internal_live_stacks[i] = __csm_internal_live_stacks[--__csm_internal_live_count];
+      break;
+    }
+  }
+  if (__csm_internal_live_count == 0) { // nothing is left for the leak checkers
+    free(__csm_internal_live_stacks);
+    __csm_internal_live_stacks = NULL;
+    __csm_internal_live_capacity = 0;
+  }
+  __csm_internal_live_exit();
+}
+
+// it adds the stack or it updates its range after Ptr_stack::ptr_list moved,
+// if there is no memory the stack leaves the list so a old range never matches
+static bool __csm_internal_live_update(Ptr_stack *stack) {
+  __csm_internal_live_enter();
+  size_t i = 0;
+  while (i < __csm_internal_live_count && __csm_internal_live_stacks[i].stack != stack)
+    i++;
+  if (i == __csm_internal_live_count) {
+    if (__csm_internal_live_count == __csm_internal_live_capacity) {
+      size_t capacity = __csm_internal_live_capacity > 0 ? __csm_internal_live_capacity * 2 : 8;
+      __csm_internal_live_stack *stacks = (__csm_internal_live_stack *)realloc(
+          __csm_internal_live_stacks, capacity * sizeof(__csm_internal_live_stack));
+      if (stacks == NULL) {
+        __csm_internal_live_exit();
+        __csm_internal_live_remove(stack);
+        return false;
+      }
+      __csm_internal_live_stacks = stacks;
+      __csm_internal_live_capacity = capacity;
+    }
+    __csm_internal_live_count++;
+  }
+  __csm_internal_live_stacks[i].stack = stack;
+  __csm_internal_live_stacks[i].begin = (uintptr_t)stack->ptr_list;
+  __csm_internal_live_stacks[i].end = (uintptr_t)(stack->ptr_list + stack->capacity);
+  __csm_internal_live_exit();
+  return true;
+}
+
+static Ptr_stack *__csm_internal_live_find(const Dyn_ptr *dyn_ptr) {
+  Ptr_stack *stack = NULL;
+  __csm_internal_live_enter();
+  for (size_t i = 0; i < __csm_internal_live_count; i++) {
+    if ((uintptr_t)dyn_ptr >= __csm_internal_live_stacks[i].begin &&
+        (uintptr_t)dyn_ptr < __csm_internal_live_stacks[i].end) {
+      stack = __csm_internal_live_stacks[i].stack;
+      break;
+    }
+  }
+  __csm_internal_live_exit();
+  return stack;
+}
+
+Ptr_stack *create_stack(size_t capacity) {
+  Ptr_stack *ptr_stack = (Ptr_stack *)malloc(sizeof(Ptr_stack));
+  if (ptr_stack == NULL)
+    return NULL;
+
+  Dyn_ptr *dyn_ptrs = (Dyn_ptr *)malloc(capacity * sizeof(Dyn_ptr));
+  if (dyn_ptrs == NULL) {
+    free(ptr_stack);
+    return NULL;
+  }
+
+  ptr_stack->capacity = capacity; // Initialize capacity
+  Arena *arena = create_arena(ptr_stack->capacity);
+  if (arena == NULL) {
+    free(dyn_ptrs);
+    free(ptr_stack);
+    return NULL;
+  }
+
+  if (!__csm_internal_stack_init_lists(ptr_stack)) {
+    arena_free(arena);
+    free(dyn_ptrs);
+    free(ptr_stack);
+    return NULL;
+  }
+
+  ptr_stack->length = 0;
+  ptr_stack->ptr_list = dyn_ptrs;
+  ptr_stack->arena = arena;
+  if (!__csm_internal_live_update(ptr_stack)) {
+    __csm_internal_stack_free_lists(ptr_stack);
+    arena_free(arena);
+    free(dyn_ptrs);
+    free(ptr_stack);
+    return NULL;
+  }
+
+  return ptr_stack;
+}
+
+#ifndef NDEBUG
+// the readers of a Stack_epoch hold raw pointers into Ptr_stack::ptr_list and
+// into the arena, so none of them can be inside when those move
+static bool __csm_internal_epoch_inside(const Ptr_stack *stack) {
+#if defined(CSM_POSIX) && defined(CSM_ATOMICS)
+  const struct Stack_epoch *epoch = stack->epoch;
+  for (unsigned i = 0; epoch != NULL && i < epoch->reader_count; i++) {
+    if (__atomic_load_n(&epoch->readers[i].epoch, __ATOMIC_RELAXED) != 0)
+      return true;
+  }
+#else
+  (void)stack;
+#endif
+  return false;
+}
+#endif
+
+static bool __csm_internal_stack_reserve(Ptr_stack *stack, size_t count) {
+  if (stack->capacity - stack->length >= count)
+    return true;
+
+  size_t capacity = stack->capacity > 0 ? stack->capacity * 2 : 16;
+  while (capacity - stack->length < count)
+    capacity *= 2;
+
+#ifdef CSM_INLINE_SIZE
+  uintptr_t old_list = (uintptr_t)stack->ptr_list;
+#endif
+  assert(!__csm_internal_epoch_inside(stack) && "ptr_list grows under Stack_epoch readers");
+  Dyn_ptr *dyn_ptrs = (Dyn_ptr *)realloc(stack->ptr_list, capacity * sizeof(Dyn_ptr));
+  if (dyn_ptrs == NULL)
+    return false;
+
+#ifdef CSM_INLINE_SIZE
+  // inline payloads live into the records so they move with the list
+  if ((uintptr_t)dyn_ptrs != old_list) {
+    for (size_t i = 0; i < stack->length; i++) {
+      if ((uintptr_t)dyn_ptrs[i].ptr ==
+          old_list + i * sizeof(Dyn_ptr) + offsetof(Dyn_ptr, inline_data))
+        dyn_ptrs[i].ptr = dyn_ptrs[i].inline_data;
+    }
+  }
+#endif
+
+  stack->ptr_list = dyn_ptrs;
+  stack->capacity = capacity;
+  // without memory for the range the stack just leaves the live list
+  __csm_internal_live_update(stack);
+  return true;
+}
+
+// a released block keeps the next block of its list and its size
+typedef struct {
+  size_t next;
+  size_t size;
+} __csm_internal_free_block;
+
+// it returns the class whose blocks all fit size or CSM_SIZE_CLASSES
+static size_t __csm_internal_alloc_class(size_t size) {
+  size_t size_class = 0;
+  while (size_class < CSM_SIZE_CLASSES && ((size_t)16 << size_class) < size)
+    size_class++;
+  return size_class;
+}
+
+// it returns the class of a released block, the bigger blocks go to the last
+static size_t __csm_internal_release_class(size_t size) {
+  size_t size_class = 0;
+  while (size_class + 1 < CSM_SIZE_CLASSES && ((size_t)32 << size_class) <= size)
+    size_class++;
+  return size_class;
+}
+
+static uint8_t *__csm_internal_stack_reuse_block(Ptr_stack *stack, size_t size) {
+  // the head of the class where a block of this size is released can fit it,
+  // so a block released and allocated again with the same size is reused
+  size_t size_class = __csm_internal_release_class(size);
+  size_t head = stack->free_lists[size_class];
+  if (head == SIZE_MAX ||
+      ((__csm_internal_free_block *)(stack->arena->block + head))->size < size)
+    size_class = __csm_internal_alloc_class(size);
+  if (size_class == CSM_SIZE_CLASSES || stack->free_lists[size_class] == SIZE_MAX)
+    return NULL;
+
+  uint8_t *block = stack->arena->block + stack->free_lists[size_class];
+  stack->free_lists[size_class] = ((__csm_internal_free_block *)block)->next;
+  return block;
+}
+
+static void __csm_internal_stack_recycle_block(Ptr_stack *stack, void *ptr, size_t size) {
+  Arena *arena = stack->arena;
+  uintptr_t offset = (uintptr_t)ptr - (uintptr_t)arena->block;
+  if (arena->kind != CSM_ARENA_HEAP || size < 16 || offset >= arena->actual_size ||
+      (uintptr_t)ptr % sizeof(size_t) != 0)
+    return;
+
+  size_t size_class = __csm_internal_release_class(size);
+  __csm_internal_free_block *node = (__csm_internal_free_block *)ptr;
+  node->next = stack->free_lists[size_class];
+  node->size = size;
+  stack->free_lists[size_class] = (size_t)offset;
+}
+
+// it hashes 32 bytes per round into four independent lanes so the
+// multiplications overlap, the tail is mixed into the first lane
+static uint64_t __csm_internal_hash(const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint64_t lanes[4] = {0x9e3779b97f4a7c15ull ^ size, 0xc2b2ae3d27d4eb4full,
+                       0x165667b19e3779f9ull, 0x85ebca77c2b2ae63ull};
+  uint64_t word;
+  for (; size >= 32; size -= 32, bytes += 32) {
+    for (int i = 0; i < 4; i++) {
+      memcpy(&word, bytes + i * 8, 8);
+      lanes[i] = (lanes[i] ^ word) * 0xff51afd7ed558ccdull;
+      lanes[i] ^= lanes[i] >> 32;
+    }
+  }
+  for (; size >= 8; size -= 8, bytes += 8) {
+    memcpy(&word, bytes, 8);
+    lanes[0] = (lanes[0] ^ word) * 0xff51afd7ed558ccdull;
+    lanes[0] ^= lanes[0] >> 32;
+  }
+  word = 0;
+  memcpy(&word, bytes, size);
+
+  uint64_t hash = lanes[0] ^ word;
+  for (int i = 1; i < 4; i++)
+    hash = (hash ^ lanes[i]) * 0xc4ceb9fe1a85ec53ull;
+  return hash ^ (hash >> 29);
+}
+
+// a slot of Ptr_stack::dedup or Ptr_stack::dedup_refs, it is empty when its
+// size is 0, refs is only used into Ptr_stack::dedup_refs
+typedef struct {
+  uint64_t hash;
+  size_t offset;
+  size_t size;
+  size_t refs;
+} __csm_internal_dedup_entry;
+
+#ifdef CSM_INLINE_SIZE
+#define __csm_internal_inline_size ((size_t)CSM_INLINE_SIZE)
+#else
+#define __csm_internal_inline_size ((size_t)0)
+#endif
+
+// Ptr_stack::dedup is placed by the hash of the payload and
+// Ptr_stack::dedup_refs by the offset of the block
+static size_t __csm_internal_dedup_home(const __csm_internal_dedup_entry *entry,
+                                        bool by_offset) {
+  if (!by_offset)
+    return (size_t)entry->hash;
+  uint64_t hash = (uint64_t)entry->offset * 0x9e3779b97f4a7c15ull;
+  return (size_t)(hash ^ (hash >> 32));
+}
+
+// it returns the slot that holds the payload or the empty slot where it goes
+static __csm_internal_dedup_entry *__csm_internal_dedup_find(Ptr_stack *stack,
+                                                             const void *data,
+                                                             size_t size, uint64_t hash) {
+  __csm_internal_dedup_entry *table =
+      get_dyn_off_ptr_data(__csm_internal_dedup_entry, stack->arena, &stack->dedup);
+  size_t mask = stack->dedup.size / sizeof(__csm_internal_dedup_entry) - 1;
+  for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+    __csm_internal_dedup_entry *entry = &table[i];
+    if (entry->size == 0 ||
+        (entry->hash == hash && entry->size == size &&
+         memcmp(stack->arena->block + entry->offset, data, size) == 0))
+      return entry;
+  }
+}
+
+// it returns the slot of table that holds the block at offset or the empty
+// slot where it goes, the payload is never read
+static __csm_internal_dedup_entry *__csm_internal_dedup_find_offset(Ptr_stack *stack,
+                                                                    Dyn_off_ptr *table_ptr,
+                                                                    uint64_t hash,
+                                                                    size_t offset) {
+  __csm_internal_dedup_entry *table =
+      get_dyn_off_ptr_data(__csm_internal_dedup_entry, stack->arena, table_ptr);
+  size_t mask = table_ptr->size / sizeof(__csm_internal_dedup_entry) - 1;
+  __csm_internal_dedup_entry key = {.hash = hash, .offset = offset, .size = 0, .refs = 0};
+  bool by_offset = table_ptr == &stack->dedup_refs;
+  for (size_t i = __csm_internal_dedup_home(&key, by_offset) & mask;; i = (i + 1) & mask) {
+    if (table[i].size == 0 || table[i].offset == offset)
+      return &table[i];
+  }
+}
+
+// it empties the slot and moves back the next ones of its run, so the
+// lookups never need tombstones
+static void __csm_internal_dedup_erase(Ptr_stack *stack, Dyn_off_ptr *table_ptr,
+                                       __csm_internal_dedup_entry *entry) {
+  __csm_internal_dedup_entry *table =
+      get_dyn_off_ptr_data(__csm_internal_dedup_entry, stack->arena, table_ptr);
+  size_t mask = table_ptr->size / sizeof(__csm_internal_dedup_entry) - 1;
+  bool by_offset = table_ptr == &stack->dedup_refs;
+  size_t hole = (size_t)(entry - table);
+  for (size_t i = (hole + 1) & mask; table[i].size != 0; i = (i + 1) & mask) {
+    size_t home = __csm_internal_dedup_home(&table[i], by_offset) & mask;
+    // the entry stays if its home is into (hole, i]
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      table[hole] = table[i];
+      hole = i;
+    }
+  }
+  table[hole].size = 0;
+}
+
+// it drops a share of the block before its deallocator can change the
+// payload, it tells if other Dyn_ptr's still share the block
+static bool __csm_internal_dedup_unref(Ptr_stack *stack, const void *ptr, size_t size) {
+  if (stack->dedup.size == 0 || size <= __csm_internal_inline_size ||
+      (const uint8_t *)ptr < stack->arena->block ||
+      (const uint8_t *)ptr >= stack->arena->block + stack->arena->actual_size)
+    return false;
+
+  size_t offset = (size_t)((const uint8_t *)ptr - stack->arena->block);
+  __csm_internal_dedup_entry *ref =
+      __csm_internal_dedup_find_offset(stack, &stack->dedup_refs, 0, offset);
+  if (ref->size == 0)
+    return false; // the block was not shared
+  if (--ref->refs > 0)
+    return true;
+
+  // the last share goes, the payload leaves both tables and the block is reused
+  __csm_internal_dedup_erase(stack, &stack->dedup,
+                             __csm_internal_dedup_find_offset(stack, &stack->dedup,
+                                                              ref->hash, offset));
+  __csm_internal_dedup_erase(stack, &stack->dedup_refs, ref);
+  stack->dedup_count--;
+  return false;
+}
+
+bool stack_release_ptr(Ptr_stack *stack, Dyn_ptr *dyn_ptr) {
+  if (stack == NULL || dyn_ptr == NULL || dyn_ptr->ptr == NULL)
+    return false;
+
+  bool shared = __csm_internal_dedup_unref(stack, dyn_ptr->ptr, dyn_ptr->size);
+  if (__csm_internal_has_dealloc(dyn_ptr)) {
+    __csm_internal_get_dealloc(stack, dyn_ptr)(dyn_ptr);
+    __csm_internal_set_null_dealloc(dyn_ptr); // its Ptr_stack::dtors entry stays
+  }
+  if (!shared)
+    __csm_internal_stack_recycle_block(stack, dyn_ptr->ptr, dyn_ptr->size);
+  dyn_ptr->ptr = NULL;
+  dyn_ptr->size = 0;
+  return true;
+}
+
+// the owner does the remote releases before it adds a Dyn_ptr or a block, so
+// a released block is reused right away
+static void __csm_internal_stack_drain(Ptr_stack *stack) {
+#if defined(CSM_POSIX) && defined(CSM_ATOMICS)
+  if (stack->remote != NULL && __atomic_load_n(&stack->remote->head, __ATOMIC_RELAXED) != NULL)
+    stack_drain_remote(stack);
+#else
+  (void)stack;
+#endif
+}
+
+static uint8_t *__csm_internal_stack_alloc_block(Ptr_stack *stack, size_t size) {
+  __csm_internal_stack_drain(stack);
+  uint8_t *reused = __csm_internal_stack_reuse_block(stack, size);
+  if (reused != NULL)
+    return reused;
+
+  Arena *arena = stack->arena;
+  Arena_ptr arena_ptr = arena_alloc_aligned(arena, size, CSM_ALIGNMENT);
+  if (arena_ptr.block != NULL)
+    return arena_ptr.block;
+
+  size_t growth = size * (size_t)2 + CSM_ALIGNMENT;
+  if (growth < arena->capacity) { // doubling keeps the rebase below amortized
+    growth = arena->capacity;
+  }
+  if (growth < 1024) { // minimum of 1KB growth.
+    growth = 1024;
+  }
+  uintptr_t old_block = (uintptr_t)arena->block;
+  uintptr_t old_end = old_block + arena->actual_size;
+  assert(!__csm_internal_epoch_inside(stack) && "the arena grows under Stack_epoch readers");
+  if (!arena_realloc(arena, growth))
+    return NULL;
+
+  // the Dyn_ptr's that live into the arena follow the block to its new address
+  if ((uintptr_t)arena->block != old_block) {
+    for (size_t i = 0; i < stack->length; i++) {
+      uintptr_t ptr = (uintptr_t)stack->ptr_list[i].ptr;
+      if (ptr >= old_block && ptr < old_end)
+        stack->ptr_list[i].ptr = arena->block + (ptr - old_block);
+    }
+  }
+
+  return arena_alloc_aligned(arena, size, CSM_ALIGNMENT).block;
+}
+
+// a source that lives into the arena moves with it when a allocation grows
+// the arena, it gets where the source is now from where the arena was
+static const void *__csm_internal_stack_follow(const Ptr_stack *stack, const void *src,
+                                              uintptr_t old_block, size_t old_size) {
+  uintptr_t ptr = (uintptr_t)src;
+  if (ptr >= old_block && ptr < old_block + old_size)
+    return stack->arena->block + (ptr - old_block);
+  return src;
+}
+
+static Dyn_ptr *__csm_internal_stack_alloc(Ptr_stack *stack, size_t size,
+                                           bool allow_inline) {
+  if (stack == NULL || size == 0 || size > CSM_MAX_PTR_SIZE)
+    return NULL;
+  __csm_internal_stack_drain(stack);
+  if (!__csm_internal_stack_reserve(stack, 1))
+    return NULL;
+
+  Dyn_ptr *dyn_ptr = &stack->ptr_list[stack->length];
+#ifdef CSM_INLINE_SIZE
+  if (allow_inline && size <= CSM_INLINE_SIZE) {
+    dyn_ptr->ptr = dyn_ptr->inline_data;
+  } else
+#else
+  (void)allow_inline;
+#endif
+  {
+    uint8_t *block = __csm_internal_stack_alloc_block(stack, size);
+    if (block == NULL)
+      return NULL;
+    dyn_ptr->ptr = block;
+  }
+
+  dyn_ptr->size = size;
+  __csm_internal_set_null_dealloc(dyn_ptr);
+  stack->length++;
+  return dyn_ptr;
+}
+
+Dyn_ptr *stack_alloc_uninit(Ptr_stack *stack, size_t size) {
+  return __csm_internal_stack_alloc(stack, size, true);
+}
+
+Dyn_ptr *stack_emplace(Ptr_stack *stack, size_t size,
+                       void (*init)(void *ptr, size_t size, void *arg),
+                       void *arg) {
+  Dyn_ptr *dyn_ptr = stack_alloc_uninit(stack, size);
+  if (dyn_ptr != NULL && init != NULL)
+    init(dyn_ptr->ptr, size, arg);
+  return dyn_ptr;
+}
+
+// it moves both tables to new ones with slots slots into the arena
+static bool __csm_internal_dedup_resize(Ptr_stack *stack, size_t slots) {
+  size_t size = slots * sizeof(__csm_internal_dedup_entry);
+  uint8_t *block = __csm_internal_stack_alloc_block(stack, 2 * size);
+  if (block == NULL)
+    return false;
+  memset(block, 0, 2 * size);
+
+  Dyn_off_ptr old = stack->dedup;
+  size_t offset = (size_t)(block - stack->arena->block);
+  stack->dedup = (Dyn_off_ptr){.offset = offset, .size = size};
+  stack->dedup_refs = (Dyn_off_ptr){.offset = offset + size, .size = size};
+  if (old.size == 0)
+    return true;
+
+  // the old tables are together too, the refs follow the payloads
+  __csm_internal_dedup_entry *entries =
+      get_dyn_off_ptr_data(__csm_internal_dedup_entry, stack->arena, &old);
+  size_t count = old.size / sizeof(__csm_internal_dedup_entry);
+  for (size_t i = 0; i < 2 * count; i++) {
+    if (entries[i].size == 0)
+      continue;
+    Dyn_off_ptr *table_ptr = i < count ? &stack->dedup : &stack->dedup_refs;
+    *__csm_internal_dedup_find_offset(stack, table_ptr, entries[i].hash,
+                                      entries[i].offset) = entries[i];
+  }
+  __csm_internal_stack_recycle_block(stack, entries, 2 * old.size);
+  return true;
+}
+
+// the Ptr_stack gives the new block, so the arena can move safely, and it
+// reuses the old one
+static bool __csm_internal_stack_vec_reserve(Arena_vec *vec, size_t capacity) {
+  Ptr_stack *stack = vec->stack;
+  uint8_t *block = __csm_internal_stack_alloc_block(stack, capacity * vec->elem_size);
+  if (block == NULL)
+    return false;
+
+  uint8_t *old = stack->arena->block + vec->offset; // read after the arena moved
+  if (vec->length > 0)
+    memcpy(block, old, vec->length * vec->elem_size);
+  if (vec->capacity > 0)
+    __csm_internal_stack_recycle_block(stack, old, vec->capacity * vec->elem_size);
+  vec->offset = (size_t)(block - stack->arena->block);
+  vec->capacity = capacity;
+  return true;
+}
+
+bool stack_vec_init(Arena_vec *vec, Ptr_stack *stack, size_t elem_size,
+                    size_t capacity) {
+  if (stack == NULL || !arena_vec_init(vec, stack->arena, elem_size, 0))
+    return false;
+
+  vec->stack = stack;
+  return capacity == 0 || arena_vec_reserve(vec, capacity);
+}
+
+bool stack_enable_dedup(Ptr_stack *stack, size_t slots) {
+  if (stack == NULL)
+    return false;
+  if (stack->dedup.size > 0)
+    return true;
+
+  size_t count = 16;
+  while (count < slots)
+    count *= 2;
+  return __csm_internal_dedup_resize(stack, count);
+}
+
+Dedup_stats stack_dedup_stats(const Ptr_stack *stack) {
+  return stack->dedup_stats;
+}
+
+#ifndef CSM_INTERN_CHUNK
+#define CSM_INTERN_CHUNK 4096 // the size of the chunks that hold interned strings
+#endif
+
+// a slot of Ptr_stack::interns, it is empty when its str is NULL
+typedef struct {
+  uint64_t hash;
+  const char *str;
+  size_t len;
+} __csm_internal_intern_entry;
+
+// it returns the slot that holds the string or the empty slot where it goes
+static __csm_internal_intern_entry *__csm_internal_intern_find(Ptr_stack *stack,
+                                                               const char *str,
+                                                               size_t len, uint64_t hash) {
+  __csm_internal_intern_entry *table =
+      get_dyn_off_ptr_data(__csm_internal_intern_entry, stack->arena, &stack->interns);
+  size_t mask = stack->interns.size / sizeof(__csm_internal_intern_entry) - 1;
+  for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+    __csm_internal_intern_entry *entry = &table[i];
+    if (entry->str == NULL ||
+        (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0))
+      return entry;
+  }
+}
+
+// it moves the index to a new one with slots slots into the arena
+static bool __csm_internal_intern_resize(Ptr_stack *stack, size_t slots) {
+  size_t size = slots * sizeof(__csm_internal_intern_entry);
+  uint8_t *block = __csm_internal_stack_alloc_block(stack, size);
+  if (block == NULL)
+    return false;
+  memset(block, 0, size);
+
+  Dyn_off_ptr old = stack->interns;
+  stack->interns = (Dyn_off_ptr){.offset = (size_t)(block - stack->arena->block), .size = size};
+  if (old.size == 0)
+    return true;
+
+  __csm_internal_intern_entry *entries =
+      get_dyn_off_ptr_data(__csm_internal_intern_entry, stack->arena, &old);
+  __csm_internal_intern_entry *table = (__csm_internal_intern_entry *)block;
+  size_t mask = slots - 1;
+  for (size_t i = 0; i < old.size / sizeof(__csm_internal_intern_entry); i++) {
+    if (entries[i].str == NULL)
+      continue;
+    size_t j = (size_t)entries[i].hash & mask;
+    while (table[j].str != NULL)
+      j = (j + 1) & mask;
+    table[j] = entries[i];
+  }
+  __csm_internal_stack_recycle_block(stack, entries, old.size);
+  return true;
+}
+
+static void __csm_internal_intern_chunk_deallocator(Dyn_ptr *dyn_ptr) {
+  free(dyn_ptr->ptr);
+}
+
+// it copies the string into the last chunk, a new chunk is started when it
+// does not fit and the long strings get a chunk for them alone
+static char *__csm_internal_intern_store(Ptr_stack *stack, const char *str, size_t len) {
+  size_t size = len + 1;
+  char *copy = stack->intern_chunk;
+  if (size <= stack->intern_left) {
+    stack->intern_chunk += size;
+    stack->intern_left -= size;
+    stack->ptr_list[stack->intern_index].size += size;
+  } else {
+    // the Dyn_ptr of a chunk only covers its used part, so stack_writev never
+    // reads the bytes that are not written yet
+    size_t chunk = size > CSM_INTERN_CHUNK / 4 ? size : CSM_INTERN_CHUNK;
+    copy = (char *)malloc(chunk);
+    if (copy == NULL)
+      return NULL;
+    Dyn_ptr *dyn_ptr =
+        stack_adopt_ptr(stack, copy, size, __csm_internal_intern_chunk_deallocator);
+    if (dyn_ptr == NULL) {
+      free(copy);
+      return NULL;
+    }
+    if (chunk > size) {
+      stack->intern_chunk = copy + size;
+      stack->intern_left = chunk - size;
+      stack->intern_index = (size_t)(dyn_ptr - stack->ptr_list);
+    }
+  }
+
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+const char *csm_intern(Ptr_stack *stack, const char *str, size_t len) {
+  if (stack == NULL || str == NULL)
+    return NULL;
+  if (stack->interns.size == 0 && !__csm_internal_intern_resize(stack, 64))
+    return NULL;
+
+  uint64_t hash = __csm_internal_hash(str, len);
+  __csm_internal_intern_entry *entry = __csm_internal_intern_find(stack, str, len, hash);
+  if (entry->str != NULL)
+    return entry->str;
+
+  size_t slots = stack->interns.size / sizeof(__csm_internal_intern_entry);
+  if ((stack->intern_count + 1) * 4 > slots * 3) {
+    if (!__csm_internal_intern_resize(stack, slots * 2))
+      return NULL;
+    entry = __csm_internal_intern_find(stack, str, len, hash);
+  }
+
+  char *copy = __csm_internal_intern_store(stack, str, len);
+  if (copy == NULL)
+    return NULL;
+  entry->hash = hash;
+  entry->str = copy;
+  entry->len = len;
+  stack->intern_count++;
+  return copy;
+}
+
+static Dyn_ptr *__csm_internal_stack_new_dedup(Ptr_stack *stack, void *data,
+                                               size_t size) {
+  uint64_t hash = __csm_internal_hash(data, size);
+  __csm_internal_dedup_entry *entry = __csm_internal_dedup_find(stack, data, size, hash);
+  stack->dedup_stats.lookups++;
+
+  if (entry->size != 0) {
+    if (!__csm_internal_stack_reserve(stack, 1))
+      return NULL;
+    __csm_internal_dedup_find_offset(stack, &stack->dedup_refs, 0, entry->offset)->refs++;
+    Dyn_ptr *dyn_ptr = &stack->ptr_list[stack->length++];
+    dyn_ptr->ptr = stack->arena->block + entry->offset;
+    dyn_ptr->size = size;
+    __csm_internal_set_null_dealloc(dyn_ptr);
+    stack->dedup_stats.hits++;
+    stack->dedup_stats.bytes_saved += size;
+    return dyn_ptr;
+  }
+
+  uintptr_t old_block = (uintptr_t)stack->arena->block;
+  size_t old_size = stack->arena->actual_size;
+  Dyn_ptr *dyn_ptr = stack_alloc_uninit(stack, size);
+  if (dyn_ptr == NULL)
+    return NULL;
+  memcpy(dyn_ptr->ptr, __csm_internal_stack_follow(stack, data, old_block, old_size), size);
+
+  // a payload that does not fit into the table is just not shared
+  size_t slots = stack->dedup.size / sizeof(__csm_internal_dedup_entry);
+  if ((stack->dedup_count + 1) * 4 > slots * 3) {
+    size_t index = (size_t)(dyn_ptr - stack->ptr_list);
+    if (!__csm_internal_dedup_resize(stack, slots * 2))
+      return dyn_ptr;
+    dyn_ptr = &stack->ptr_list[index];
+  }
+  size_t offset = (size_t)((uint8_t *)dyn_ptr->ptr - stack->arena->block);
+  __csm_internal_dedup_entry added = {.hash = hash, .offset = offset, .size = size, .refs = 1};
+  *__csm_internal_dedup_find(stack, dyn_ptr->ptr, size, hash) = added;
+  *__csm_internal_dedup_find_offset(stack, &stack->dedup_refs, hash, offset) = added;
+  stack->dedup_count++;
+  return dyn_ptr;
+}
+
+Dyn_ptr *stack_new_ptr(Ptr_stack *stack, void *data, size_t dataSize) {
+  if (data == NULL)
+    return NULL;
+  if (stack != NULL) // before the dedup tables are read
+    __csm_internal_stack_drain(stack);
+  if (stack != NULL && stack->dedup.size > 0 && dataSize > __csm_internal_inline_size)
+    return __csm_internal_stack_new_dedup(stack, data, dataSize);
+
+  uintptr_t old_block = stack != NULL ? (uintptr_t)stack->arena->block : 0;
+  size_t old_size = stack != NULL ? stack->arena->actual_size : 0;
+  Dyn_ptr *dyn_ptr = stack_alloc_uninit(stack, dataSize);
+  if (dyn_ptr == NULL)
+    return NULL;
+
+  memcpy(dyn_ptr->ptr, __csm_internal_stack_follow(stack, data, old_block, old_size), dataSize);
+  return dyn_ptr;
+}
+
+bool stack_new_ptrs(Ptr_stack *stack, const struct iovec *iov, size_t count,
+                    Dyn_ptr **out) {
+  if (stack == NULL || (iov == NULL && count > 0))
+    return false;
+  __csm_internal_stack_drain(stack);
+  if (!__csm_internal_stack_reserve(stack, count))
+    return false;
+
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+#ifdef CSM_INLINE_SIZE
+    if (iov[i].iov_len <= CSM_INLINE_SIZE)
+      continue;
+#endif
+    if (iov[i].iov_len > CSM_MAX_PTR_SIZE)
+      return false;
+    size_t size = (iov[i].iov_len + (CSM_ALIGNMENT - 1)) & ~(size_t)(CSM_ALIGNMENT - 1);
+    if (size < iov[i].iov_len || total + size < total)
+      return false;
+    total += size;
+  }
+
+  uintptr_t old_block = (uintptr_t)stack->arena->block;
+  size_t old_size = stack->arena->actual_size;
+  uint8_t *block = NULL;
+  if (total > 0) {
+    block = __csm_internal_stack_alloc_block(stack, total);
+    if (block == NULL)
+      return false;
+  }
+
+  Dyn_ptr *dyn_ptrs = &stack->ptr_list[stack->length];
+  for (size_t i = 0; i < count; i++) {
+    size_t size = iov[i].iov_len;
+    const void *src = __csm_internal_stack_follow(stack, iov[i].iov_base, old_block, old_size);
+    dyn_ptrs[i].ptr = size > 0 ? block : NULL;
+    dyn_ptrs[i].size = size;
+    __csm_internal_set_null_dealloc(&dyn_ptrs[i]);
+#ifdef CSM_INLINE_SIZE
+    if (size > 0 && size <= CSM_INLINE_SIZE) {
+      dyn_ptrs[i].ptr = dyn_ptrs[i].inline_data;
+      memcpy(dyn_ptrs[i].inline_data, src, size);
+      continue;
+    }
+#endif
+    if (size > 0) {
+      memcpy(block, src, size);
+      block += (size + (CSM_ALIGNMENT - 1)) & ~(size_t)(CSM_ALIGNMENT - 1);
+    }
+  }
+  stack->length += count;
+
+  if (out != NULL)
+    *out = dyn_ptrs;
+  return true;
+}
+
+Dyn_off_ptr stack_new_off_ptr(Ptr_stack *stack, void *data, size_t dataSize) {
+  if (stack == NULL || data == NULL || dataSize == 0)
+    return (Dyn_off_ptr){.offset = 0, .size = 0};
+
+  uintptr_t old_block = (uintptr_t)stack->arena->block;
+  size_t old_size = stack->arena->actual_size;
+  uint8_t *block = __csm_internal_stack_alloc_block(stack, dataSize);
+  if (block == NULL)
+    return (Dyn_off_ptr){.offset = 0, .size = 0};
+
+  memcpy(block, __csm_internal_stack_follow(stack, data, old_block, old_size), dataSize);
+  return (Dyn_off_ptr){.offset = (size_t)(block - stack->arena->block),
+                       .size = dataSize};
+}
+
+Dyn_ptr *stack_adopt_ptr(Ptr_stack *stack, void *ptr, size_t size,
+                         void (*dealloc)(Dyn_ptr *)) {
+  if (stack == NULL || ptr == NULL || size > CSM_MAX_PTR_SIZE)
+    return NULL;
+  __csm_internal_stack_drain(stack);
+  if (!__csm_internal_stack_reserve(stack, 1))
+    return NULL;
+
+  Dyn_ptr *dyn_ptr = &stack->ptr_list[stack->length];
+  dyn_ptr->ptr = ptr;
+  dyn_ptr->size = size;
+  __csm_internal_set_null_dealloc(dyn_ptr);
+  if (!__csm_internal_set_dealloc(stack, dyn_ptr, dealloc))
+    return NULL;
+  stack->length++;
+  return dyn_ptr;
+}
+
+void dyn_ptr_alloc(Ptr_stack *stack, Dyn_ptr *dyn_ptr, void *data,
+                   size_t size) {
+  if (stack == NULL || dyn_ptr == NULL || data == NULL || size == 0 ||
+      size > CSM_MAX_PTR_SIZE) {
+    return;
+  }
+
+  uintptr_t old_block = (uintptr_t)stack->arena->block;
+  size_t old_size = stack->arena->actual_size;
+  uint8_t *block = __csm_internal_stack_alloc_block(stack, size);
+
+  if (block == NULL) {
+    return;
+  }
+
+  memcpy(block, __csm_internal_stack_follow(stack, data, old_block, old_size), size);
+
+  dyn_ptr->ptr = block;
+  dyn_ptr->size = size;
+}
+
+void dyn_ptr_insert_deallocator(Dyn_ptr *dyn_ptr, void (*dealloc)(Dyn_ptr *)) {
+  if (dyn_ptr == NULL)
+    return;
+  Ptr_stack *stack = __csm_internal_live_find(dyn_ptr);
+  if (stack != NULL) {
+    __csm_internal_set_dealloc(stack, dyn_ptr, dealloc);
+    return;
+  }
+#ifndef CSM_COMPACT_DYN_PTR
+  dyn_ptr->dealloc = dealloc != NULL ? dealloc : null_deallocator;
+#endif
+}
+
+bool stack_insert_deallocator(Ptr_stack *stack, Dyn_ptr *dyn_ptr,
+                              void (*dealloc)(Dyn_ptr *)) {
+  if (stack == NULL || dyn_ptr == NULL)
+    return false;
+  return __csm_internal_set_dealloc(stack, dyn_ptr, dealloc);
+}
+
+void null_deallocator(Dyn_ptr *_) {
+  (void)_;
+};
+
+#undef get_dyn_ptr_data
+
+/**
+ * @def get_dyn_ptr_data(T, dyn_ptr)
+ * @brief it transform Dyn_ptr data to a specific type and it returns it
+ * @param T is the type to what Dyn_ptr data is gonna transform
+ * @param dyn_ptr is the Dyn_ptr where data is gonna be accessed
+ */
+#define get_dyn_ptr_data(T, dyn_ptr) (T *)(dyn_ptr->ptr)
+
+bool stack_register_batch_deallocator(Ptr_stack *stack,
+                                      void (*dealloc)(Dyn_ptr *),
+                                      void (*batch)(Dyn_ptr **dyn_ptrs,
+                                                    size_t count)) {
+  if (stack == NULL || dealloc == NULL || batch == NULL)
+    return false;
+
+  for (size_t i = 0; i < stack->group_count; i++) {
+    if (stack->groups[i].dealloc == dealloc) {
+      stack->groups[i].batch = batch;
+      return true;
+    }
+  }
+
+  Dealloc_group *groups = (Dealloc_group *)realloc(
+      stack->groups, (stack->group_count + 1) * sizeof(Dealloc_group));
+  if (groups == NULL)
+    return false;
+  groups[stack->group_count].dealloc = dealloc;
+  groups[stack->group_count].batch = batch;
+  stack->groups = groups;
+  stack->group_count++;
+  return true;
+}
+
+// it returns the index of the Dealloc_group of dealloc or group_count
+static size_t __csm_internal_find_group(Ptr_stack *stack, void (*dealloc)(Dyn_ptr *)) {
+  size_t group = 0;
+  while (group < stack->group_count && stack->groups[group].dealloc != dealloc)
+    group++;
+  return group;
+}
+
+#ifndef CSM_BATCH_SIZE
+#define CSM_BATCH_SIZE 256 // the most Dyn_ptr's that a batch function gets at once
+#endif
+
+// it runs the deallocators of Ptr_stack::dtors from end - 1 to begin, the
+// consecutive entries with the same batch function are destroyed in one call
+static void __csm_internal_stack_run_deallocs(Ptr_stack *stack, size_t begin,
+                                              size_t end) {
+  Dyn_ptr *batch[CSM_BATCH_SIZE];
+  size_t batch_len = 0;
+  size_t batch_group = stack->group_count;
+  void (*last)(Dyn_ptr *) = NULL;
+  size_t last_group = stack->group_count;
+
+  for (size_t i = end; i-- > begin;) {
+    Dyn_ptr *dyn_ptr = &stack->ptr_list[stack->dtors[i]];
+    void (*dealloc)(Dyn_ptr *) = __csm_internal_get_dealloc(stack, dyn_ptr);
+    if (dealloc != last) {
+      last = dealloc;
+      last_group = __csm_internal_find_group(stack, dealloc);
+    }
+
+    if (batch_len > 0 && (last_group != batch_group || batch_len == CSM_BATCH_SIZE)) {
+      stack->groups[batch_group].batch(batch, batch_len);
+      batch_len = 0;
+    }
+
+    if (last_group == stack->group_count) {
+      dealloc(dyn_ptr);
+    } else {
+      batch_group = last_group;
+      batch[batch_len++] = dyn_ptr;
+    }
+  }
+
+  if (batch_len > 0)
+    stack->groups[batch_group].batch(batch, batch_len);
+}
+
+bool stack_free_step(Ptr_stack *stack, size_t max_items) {
+  // Ptr_stack::dtor_count is the cursor, the entries after it were destroyed
+  size_t count = stack->dtor_count < max_items ? stack->dtor_count : max_items;
+  __csm_internal_stack_run_deallocs(stack, stack->dtor_count - count, stack->dtor_count);
+  stack->dtor_count -= count;
+  if (stack->dtor_count > 0)
+    return false;
+
+  stack_free(stack);
+  return true;
+}
+
+bool stack_free_barrier(Ptr_stack *stack) {
+  if (stack == NULL)
+    return false;
+  if (stack->barrier_count > 0 &&
+      stack->barriers[stack->barrier_count - 1] == stack->dtor_count)
+    return true;
+
+  // the count is a power of 2 when the array is full
+  size_t count = stack->barrier_count;
+  if (count == 0 || (count & (count - 1)) == 0) {
+    size_t *barriers = (size_t *)realloc(
+        stack->barriers, (count > 0 ? count * 2 : 1) * sizeof(size_t));
+    if (barriers == NULL)
+      return false;
+    stack->barriers = barriers;
+  }
+  stack->barriers[stack->barrier_count++] = stack->dtor_count;
+  return true;
+}
+
+void stack_free(Ptr_stack *stack) {
+  // only the slots that got a deallocator are visited, a slot whose deallocator
+  // was set back to NULL calls null_deallocator
+  __csm_internal_stack_run_deallocs(stack, 0, stack->dtor_count);
+
+  __csm_internal_live_remove(stack);
+  __csm_internal_stack_free_lists(stack);
+  free(stack->ptr_list);
+  arena_free(stack->arena);
+  free(stack);
+}
+
+Ptr_stack_soa *create_stack_soa(size_t capacity) {
+  Ptr_stack_soa *stack = (Ptr_stack_soa *)calloc(1, sizeof(Ptr_stack_soa));
+  if (stack == NULL)
+    return NULL;
+
+  if (capacity == 0)
+    capacity = 16;
+  stack->arena = create_arena(capacity);
+  stack->ptrs = (void **)malloc(capacity * sizeof(void *));
+  stack->sizes = (size_t *)malloc(capacity * sizeof(size_t));
+  stack->dealloc_ids = (uint16_t *)malloc(capacity * sizeof(uint16_t));
+  stack->deallocs = (void (**)(Dyn_ptr *))malloc(8 * sizeof(*stack->deallocs));
+  if (stack->arena == NULL || stack->ptrs == NULL || stack->sizes == NULL ||
+      stack->dealloc_ids == NULL || stack->deallocs == NULL) {
+    stack_soa_free(stack);
+    return NULL;
+  }
+
+  stack->deallocs[0] = NULL; // id 0 is "no deallocator"
+  stack->dealloc_count = 1;
+  stack->dealloc_capacity = 8;
+  stack->capacity = capacity;
+  return stack;
+}
+
+static bool __csm_internal_stack_soa_reserve(Ptr_stack_soa *stack) {
+  if (stack->length < stack->capacity)
+    return true;
+
+  size_t capacity = stack->capacity * 2;
+  void **ptrs = (void **)realloc(stack->ptrs, capacity * sizeof(void *));
+  if (ptrs == NULL)
+    return false;
+  stack->ptrs = ptrs;
+  size_t *sizes = (size_t *)realloc(stack->sizes, capacity * sizeof(size_t));
+  if (sizes == NULL)
+    return false;
+  stack->sizes = sizes;
+  uint16_t *ids = (uint16_t *)realloc(stack->dealloc_ids, capacity * sizeof(uint16_t));
+  if (ids == NULL)
+    return false;
+  stack->dealloc_ids = ids;
+
+  stack->capacity = capacity;
+  return true;
+}
+
+size_t stack_soa_new_ptr(Ptr_stack_soa *stack, const void *data, size_t size) {
+  if (stack == NULL || size == 0 || size > CSM_MAX_PTR_SIZE ||
+      !__csm_internal_stack_soa_reserve(stack))
+    return SIZE_MAX;
+
+  Arena *arena = stack->arena;
+  Arena_ptr arena_ptr = arena_alloc_aligned(arena, size, CSM_ALIGNMENT);
+  if (arena_ptr.block == NULL) {
+    size_t growth = size * (size_t)2 + CSM_ALIGNMENT;
+    if (growth < arena->capacity)
+      growth = arena->capacity;
+    uintptr_t old_block = (uintptr_t)arena->block;
+    size_t old_size = arena->actual_size;
+    if (!arena_realloc(arena, growth))
+      return SIZE_MAX;
+
+    // all the entries live into the arena so they all follow the block, data
+    // too when it is one of them
+    if ((uintptr_t)arena->block != old_block) {
+      for (size_t i = 0; i < stack->length; i++)
+        stack->ptrs[i] = arena->block + ((uintptr_t)stack->ptrs[i] - old_block);
+      if ((uintptr_t)data >= old_block && (uintptr_t)data < old_block + old_size)
+        data = arena->block + ((uintptr_t)data - old_block);
+    }
+    arena_ptr = arena_alloc_aligned(arena, size, CSM_ALIGNMENT);
+  }
+
+  if (data != NULL)
+    memcpy(arena_ptr.block, data, size);
+  stack->ptrs[stack->length] = arena_ptr.block;
+  stack->sizes[stack->length] = size;
+  stack->dealloc_ids[stack->length] = 0;
+  return stack->length++;
+}
+
+void *stack_soa_data(Ptr_stack_soa *stack, size_t index) {
+  if (stack == NULL || index >= stack->length)
+    return NULL;
+  return stack->ptrs[index];
+}
+
+size_t stack_soa_total_size(const Ptr_stack_soa *stack) {
+  size_t total = 0;
+  const size_t *sizes = stack->sizes;
+  for (size_t i = 0; i < stack->length; i++)
+    total += sizes[i];
+  return total;
+}
+
+bool stack_soa_insert_deallocator(Ptr_stack_soa *stack, size_t index,
+                                  void (*dealloc)(Dyn_ptr *)) {
+  if (stack == NULL || index >= stack->length)
+    return false;
+  if (dealloc == NULL || dealloc == null_deallocator) {
+    stack->dealloc_ids[index] = 0;
+    return true;
+  }
+
+  uint16_t id = 1;
+  while (id < stack->dealloc_count && stack->deallocs[id] != dealloc)
+    id++;
+
+  if (id == stack->dealloc_count) {
+    if (stack->dealloc_count == UINT16_MAX)
+      return false;
+    if (stack->dealloc_count == stack->dealloc_capacity) {
+      uint16_t capacity = stack->dealloc_capacity > UINT16_MAX / 2
+                              ? UINT16_MAX
+                              : (uint16_t)(stack->dealloc_capacity * 2);
+      void (**deallocs)(Dyn_ptr *) = (void (**)(Dyn_ptr *))realloc(
+          stack->deallocs, capacity * sizeof(*deallocs));
+      if (deallocs == NULL)
+        return false;
+      stack->deallocs = deallocs;
+      stack->dealloc_capacity = capacity;
+    }
+    stack->deallocs[stack->dealloc_count++] = dealloc;
+  }
+  stack->dealloc_ids[index] = id;
+  return true;
+}
+
+void stack_soa_free(Ptr_stack_soa *stack) {
+  if (stack == NULL)
+    return;
+
+  for (size_t i = 0; i < stack->length; i++) {
+    if (stack->dealloc_ids[i] == 0)
+      continue;
+
+    Dyn_ptr dyn_ptr;
+    memset(&dyn_ptr, 0, sizeof(dyn_ptr));
+    dyn_ptr.ptr = stack->ptrs[i];
+    dyn_ptr.size = stack->sizes[i];
+    stack->deallocs[stack->dealloc_ids[i]](&dyn_ptr);
+  }
+
+  free(stack->deallocs);
+  free(stack->dealloc_ids);
+  free(stack->sizes);
+  free(stack->ptrs);
+  if (stack->arena != NULL)
+    arena_free(stack->arena);
+  free(stack);
+}
+
+#ifdef CSM_POSIX
+#define CSM_SNAPSHOT_MAGIC 0x314d5343u // "CSM1"
+#define CSM_SNAPSHOT_NULL UINT64_MAX
+
+typedef struct {
+  uint32_t magic;
+  uint32_t entry_size;
+  uint64_t length;
+  uint64_t arena_size;
+  uint64_t block_offset;
+} Stack_snapshot_header;
+
+static bool __csm_internal_pwrite_all(int fd, const void *buf, size_t size, off_t offset) {
+  const uint8_t *bytes = (const uint8_t *)buf;
+  while (size > 0) {
+    ssize_t written = pwrite(fd, bytes, size, offset);
+    if (written < 0)
+      return false;
+    bytes += written;
+    size -= (size_t)written;
+    offset += written;
+  }
+  return true;
+}
+
+static bool __csm_internal_pread_all(int fd, void *buf, size_t size, off_t offset) {
+  uint8_t *bytes = (uint8_t *)buf;
+  while (size > 0) {
+    ssize_t got = pread(fd, bytes, size, offset);
+    if (got <= 0)
+      return false;
+    bytes += got;
+    size -= (size_t)got;
+    offset += got;
+  }
+  return true;
+}
+
+bool stack_snapshot(Ptr_stack *stack, int fd) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t meta_size = sizeof(Stack_snapshot_header) +
+                     stack->length * 2 * sizeof(uint64_t);
+  size_t block_offset = (meta_size + page - 1) / page * page;
+  size_t inline_size = 0;
+#ifdef CSM_INLINE_SIZE
+  // inline payloads are written after the arena block so the restored
+  // Dyn_ptr's point into the mapping like the others
+  size_t inline_align = (CSM_INLINE_SIZE + (CSM_ALIGNMENT - 1)) & ~(size_t)(CSM_ALIGNMENT - 1);
+  for (size_t i = 0; i < stack->length; i++) {
+    if (stack->ptr_list[i].ptr == stack->ptr_list[i].inline_data)
+      inline_size += inline_align;
+  }
+#endif
+  size_t arena_size = (stack->arena->actual_size + (CSM_ALIGNMENT - 1)) &
+                      ~(size_t)(CSM_ALIGNMENT - 1);
+
+  uint8_t *meta = (uint8_t *)calloc(1, block_offset + inline_size);
+  if (meta == NULL)
+    return false;
+  uint8_t *inline_tail = meta + block_offset;
+
+  Stack_snapshot_header *header = (Stack_snapshot_header *)meta;
+  header->magic = CSM_SNAPSHOT_MAGIC;
+  header->entry_size = 2 * sizeof(uint64_t);
+  header->length = stack->length;
+  header->arena_size = inline_size > 0 ? arena_size + inline_size
+                                       : stack->arena->actual_size;
+  header->block_offset = block_offset;
+
+  uint64_t *entries = (uint64_t *)(meta + sizeof(Stack_snapshot_header));
+  size_t inline_offset = 0;
+  for (size_t i = 0; i < stack->length; i++) {
+    uint8_t *ptr = (uint8_t *)stack->ptr_list[i].ptr;
+    if (__csm_internal_is_file_ptr(&stack->ptr_list[i]) ||
+        __csm_internal_get_dealloc(stack, &stack->ptr_list[i]) ==
+            __csm_internal_intern_chunk_deallocator) {
+      // the data stays into its file or into a chunk of csm_intern, the index
+      // is kept with a empty Dyn_ptr
+      entries[i * 2] = CSM_SNAPSHOT_NULL;
+      entries[i * 2 + 1] = 0;
+      continue;
+    }
+    if (ptr == NULL) {
+      entries[i * 2] = CSM_SNAPSHOT_NULL;
+#ifdef CSM_INLINE_SIZE
+    } else if (ptr == stack->ptr_list[i].inline_data) {
+      memcpy(inline_tail + inline_offset, ptr, stack->ptr_list[i].size);
+      entries[i * 2] = (uint64_t)(arena_size + inline_offset);
+      inline_offset += inline_align;
+#endif
+    } else if (ptr >= stack->arena->block &&
+               ptr < stack->arena->block + stack->arena->actual_size) {
+      entries[i * 2] = (uint64_t)(ptr - stack->arena->block);
+    } else {
+      free(meta);
+      return false;
+    }
+    entries[i * 2 + 1] = stack->ptr_list[i].size;
+  }
+
+  (void)inline_tail;
+  (void)inline_offset;
+
+  static const uint8_t padding[CSM_ALIGNMENT] = {0};
+  // the offsets are absolute like the ones that stack_restore reads
+  bool ok = __csm_internal_pwrite_all(fd, meta, block_offset, 0) &&
+            __csm_internal_pwrite_all(fd, stack->arena->block,
+                                      stack->arena->actual_size, (off_t)block_offset);
+  if (ok && inline_size > 0) {
+    ok = __csm_internal_pwrite_all(fd, padding, arena_size - stack->arena->actual_size,
+                                   (off_t)(block_offset + stack->arena->actual_size)) &&
+         __csm_internal_pwrite_all(fd, inline_tail, inline_size,
+                                   (off_t)(block_offset + arena_size));
+  }
+  free(meta);
+  return ok;
+}
+
+Ptr_stack *stack_restore(int fd, Restore_mode mode) {
+  Stack_snapshot_header header;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !__csm_internal_pread_all(fd, &header, sizeof(header), 0) ||
+      header.magic != CSM_SNAPSHOT_MAGIC ||
+      header.entry_size != 2 * sizeof(uint64_t))
+    return NULL;
+
+  // the entries must be before the block and the block into the file, a
+  // mapping past the end of the file gives SIGBUS when it is read
+  uint64_t file_size = (uint64_t)st.st_size;
+  if (header.block_offset < sizeof(header) || header.block_offset > file_size ||
+      header.length > (header.block_offset - sizeof(header)) / header.entry_size ||
+      header.arena_size > file_size - header.block_offset ||
+      (uint64_t)(size_t)header.arena_size != header.arena_size ||
+      (uint64_t)(size_t)(header.length * header.entry_size) != header.length * header.entry_size)
+    return NULL;
+
+  Ptr_stack *stack = (Ptr_stack *)malloc(sizeof(Ptr_stack));
+  Arena *arena = (Arena *)malloc(sizeof(Arena));
+  size_t capacity = header.length > 0 ? (size_t)header.length : 1;
+  Dyn_ptr *dyn_ptrs = (Dyn_ptr *)malloc(capacity * sizeof(Dyn_ptr));
+  uint64_t *entries = (uint64_t *)malloc(capacity * 2 * sizeof(uint64_t));
+  if (stack == NULL || arena == NULL || dyn_ptrs == NULL || entries == NULL)
+    goto fail;
+
+  if (header.length > 0 &&
+      !__csm_internal_pread_all(fd, entries,
+                                (size_t)header.length * 2 * sizeof(uint64_t),
+                                (off_t)sizeof(header)))
+    goto fail;
+
+  // mmap does not accept a empty mapping, one byte past the end is never read
+  arena->mapping_size = header.arena_size > 0 ? (size_t)header.arena_size : 1;
+  arena->mapping = mmap(NULL, arena->mapping_size,
+                        mode == CSM_RESTORE_READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE,
+                        mode == CSM_RESTORE_READ_ONLY ? MAP_SHARED : MAP_PRIVATE,
+                        fd, (off_t)header.block_offset);
+  if (arena->mapping == MAP_FAILED)
+    goto fail;
+
+  arena->block = (uint8_t *)arena->mapping;
+  arena->capacity = (size_t)header.arena_size;
+  arena->actual_size = (size_t)header.arena_size;
+  arena->kind = CSM_ARENA_MAPPED;
+
+  for (size_t i = 0; i < header.length; i++) {
+    uint64_t offset = entries[i * 2];
+    uint64_t size = entries[i * 2 + 1];
+    if ((offset == CSM_SNAPSHOT_NULL ? size != 0
+                                     : offset > header.arena_size ||
+                                           size > header.arena_size - offset) ||
+        size > CSM_MAX_PTR_SIZE) {
+      munmap(arena->mapping, arena->mapping_size);
+      goto fail;
+    }
+    dyn_ptrs[i].ptr = offset == CSM_SNAPSHOT_NULL ? NULL : arena->block + offset;
+    dyn_ptrs[i].size = (size_t)size;
+    __csm_internal_set_null_dealloc(&dyn_ptrs[i]);
+  }
+
+  if (!__csm_internal_stack_init_lists(stack)) {
+    munmap(arena->mapping, arena->mapping_size);
+    goto fail;
+  }
+  free(entries);
+
+  stack->arena = arena;
+  stack->ptr_list = dyn_ptrs;
+  stack->length = (size_t)header.length;
+  stack->capacity = capacity;
+  if (!__csm_internal_live_update(stack)) {
+    stack_free(stack);
+    return NULL;
+  }
+  return stack;
+
+fail:
+  free(entries);
+  free(dyn_ptrs);
+  free(arena);
+  free(stack);
+  return NULL;
+}
+
+// it shrinks the last Dyn_ptr of the stack and it gives the tail back to the
+// arena when the data is the last block, a size of 0 removes the Dyn_ptr
+static void __csm_internal_stack_trim_last(Ptr_stack *stack, size_t size) {
+  Dyn_ptr *dyn_ptr = &stack->ptr_list[stack->length - 1];
+  Arena *arena = stack->arena;
+  uint8_t *end = (uint8_t *)dyn_ptr->ptr + dyn_ptr->size;
+  if (arena->kind == CSM_ARENA_HEAP && end == arena->block + arena->actual_size)
+    arena->actual_size -= dyn_ptr->size - size;
+  else if (size == 0) // a reused block goes back to its free list
+    __csm_internal_stack_recycle_block(stack, dyn_ptr->ptr, dyn_ptr->size);
+
+  dyn_ptr->size = size;
+  if (size == 0)
+    stack->length--;
+}
+
+static Dyn_ptr *__csm_internal_stack_read(Ptr_stack *stack, int fd, size_t size,
+                                          off_t offset, bool positioned) {
+  Dyn_ptr *dyn_ptr = stack_alloc_uninit(stack, size);
+  if (dyn_ptr == NULL)
+    return NULL;
+
+  size_t done = 0;
+  while (done < size) {
+    uint8_t *dst = (uint8_t *)dyn_ptr->ptr + done;
+    ssize_t got = positioned ? pread(fd, dst, size - done, offset + (off_t)done)
+                             : read(fd, dst, size - done);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0) {
+      __csm_internal_stack_trim_last(stack, 0);
+      return NULL;
+    }
+    if (got == 0)
+      break;
+    done += (size_t)got;
+  }
+
+  __csm_internal_stack_trim_last(stack, done);
+  return done > 0 ? dyn_ptr : NULL;
+}
+
+Dyn_ptr *stack_read_fd(Ptr_stack *stack, int fd, size_t size) {
+  return __csm_internal_stack_read(stack, fd, size, 0, false);
+}
+
+Dyn_ptr *stack_pread_fd(Ptr_stack *stack, int fd, size_t size, off_t offset) {
+  return __csm_internal_stack_read(stack, fd, size, offset, true);
+}
+
+ssize_t stack_read_stream(Ptr_stack *stack, int fd, size_t chunk_size,
+                          bool (*on_chunk)(Dyn_ptr *chunk, void *arg),
+                          void *arg) {
+  ssize_t total = 0;
+  for (;;) {
+    Dyn_ptr *chunk = stack_alloc_uninit(stack, chunk_size);
+    if (chunk == NULL)
+      return -1;
+
+    ssize_t got = read(fd, chunk->ptr, chunk_size);
+    if (got <= 0) {
+      __csm_internal_stack_trim_last(stack, 0);
+      if (got < 0 && errno == EINTR)
+        continue;
+      return got == 0 ? total : -1;
+    }
+
+    __csm_internal_stack_trim_last(stack, (size_t)got);
+    total += got;
+    if (on_chunk != NULL && !on_chunk(chunk, arg))
+      return total;
+  }
+}
+
+typedef struct {
+  int fd;
+  off_t offset;
+  size_t size;
+} Dyn_file;
+
+// a file Dyn_ptr holds a Dyn_file with size 0 until it is mapped, after that
+// it holds the data and the mapping starts at the page of the data
+static void __csm_internal_file_deallocator(Dyn_ptr *dyn_ptr) {
+  if (dyn_ptr->size == 0) {
+    Dyn_file *file = (Dyn_file *)dyn_ptr->ptr;
+    close(file->fd);
+    free(file);
+    return;
+  }
+
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)dyn_ptr->ptr & ~(page - 1);
+  munmap((void *)start, (uintptr_t)dyn_ptr->ptr - start + dyn_ptr->size);
+}
+
+Dyn_ptr *stack_new_file_ptr(Ptr_stack *stack, int fd, off_t offset, size_t size) {
+  if (stack == NULL || size == 0 || size > CSM_MAX_PTR_SIZE)
+    return NULL;
+
+  Dyn_file *file = (Dyn_file *)malloc(sizeof(Dyn_file));
+  if (file == NULL)
+    return NULL;
+
+  file->fd = dup(fd);
+  file->offset = offset;
+  file->size = size;
+  if (file->fd < 0) {
+    free(file);
+    return NULL;
+  }
+
+  Dyn_ptr *dyn_ptr = stack_adopt_ptr(stack, file, 0, __csm_internal_file_deallocator);
+  if (dyn_ptr == NULL) {
+    close(file->fd);
+    free(file);
+  }
+  return dyn_ptr;
+}
+
+void *dyn_ptr_map(Dyn_ptr *dyn_ptr) {
+  if (!__csm_internal_is_file_ptr(dyn_ptr) || dyn_ptr->size > 0)
+    return dyn_ptr->ptr;
+
+  Dyn_file *file = (Dyn_file *)dyn_ptr->ptr;
+  off_t page = (off_t)sysconf(_SC_PAGESIZE);
+  off_t start = file->offset / page * page;
+  size_t skip = (size_t)(file->offset - start);
+  void *mapping = mmap(NULL, skip + file->size, PROT_READ, MAP_PRIVATE, file->fd, start);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  close(file->fd);
+  dyn_ptr->ptr = (uint8_t *)mapping + skip;
+  dyn_ptr->size = file->size;
+  free(file);
+  return dyn_ptr->ptr;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define CSM_IOV_BATCH (IOV_MAX < 1024 ? IOV_MAX : 1024)
+
+ssize_t stack_writev(Ptr_stack *stack, int fd, Stack_range range) {
+  struct iovec iov[CSM_IOV_BATCH];
+  size_t end = range.start + range.count;
+  if (end > stack->length || end < range.start)
+    end = stack->length;
+
+  ssize_t total = 0;
+  size_t i = range.start;
+  while (i < end) {
+    int count = 0;
+    for (; i < end && count < CSM_IOV_BATCH; i++) {
+      if (stack->ptr_list[i].ptr == NULL || stack->ptr_list[i].size == 0)
+        continue;
+      iov[count].iov_base = stack->ptr_list[i].ptr;
+      iov[count].iov_len = stack->ptr_list[i].size;
+      count++;
+    }
+
+    struct iovec *pending = iov;
+    while (count > 0) {
+      ssize_t written = writev(fd, pending, count);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      total += written;
+
+      // a short write leaves a part of the batch, it is skipped and retried
+      while (count > 0 && (size_t)written >= pending->iov_len) {
+        written -= (ssize_t)pending->iov_len;
+        pending++;
+        count--;
+      }
+      if (count > 0) {
+        pending->iov_base = (uint8_t *)pending->iov_base + written;
+        pending->iov_len -= (size_t)written;
+      }
+    }
+  }
+  return total;
+}
+
+static uint64_t __csm_internal_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+bool stack_free_step_timed(Ptr_stack *stack, uint64_t budget_ns) {
+  uint64_t deadline = __csm_internal_now_ns() + budget_ns;
+  while (stack->dtor_count > 64) {
+    stack_free_step(stack, 64);
+    if (__csm_internal_now_ns() >= deadline)
+      return false;
+  }
+  return stack_free_step(stack, 64);
+}
+
+#define CSM_FREE_CHUNK 1024 // the number of Ptr_stack::dtors that a thread takes at once
+
+typedef struct {
+  Ptr_stack *stack;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t begin; // the range of the actual phase is from begin to next
+  size_t next;
+  unsigned running; // threads that still run a chunk of the actual phase
+  bool done;
+} __csm_internal_free_pool;
+
+// it runs chunks of the actual phase until it is empty, the lock is held when
+// it is called and when it returns
+static void __csm_internal_free_pool_work(__csm_internal_free_pool *pool) {
+  while (pool->next > pool->begin) {
+    size_t end = pool->next;
+    size_t begin = end - pool->begin > CSM_FREE_CHUNK ? end - CSM_FREE_CHUNK : pool->begin;
+    pool->next = begin;
+    pool->running++;
+    pthread_mutex_unlock(&pool->lock);
+
+    __csm_internal_stack_run_deallocs(pool->stack, begin, end);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0 && pool->next == pool->begin)
+      pthread_cond_broadcast(&pool->cond);
+  }
+}
+
+static void *__csm_internal_free_worker(void *arg) {
+  __csm_internal_free_pool *pool = (__csm_internal_free_pool *)arg;
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->done) {
+    __csm_internal_free_pool_work(pool);
+    if (!pool->done)
+      pthread_cond_wait(&pool->cond, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+void stack_free_parallel(Ptr_stack *stack, unsigned threads) {
+  if (threads > 64)
+    threads = 64;
+  if (threads <= 1 || stack->dtor_count < 2 * CSM_FREE_CHUNK) {
+    stack_free(stack);
+    return;
+  }
+
+  __csm_internal_free_pool pool;
+  pool.stack = stack;
+  pool.begin = 0;
+  pool.next = 0;
+  pool.running = 0;
+  pool.done = false;
+  if (pthread_mutex_init(&pool.lock, NULL) != 0) {
+    stack_free(stack);
+    return;
+  }
+  if (pthread_cond_init(&pool.cond, NULL) != 0) {
+    pthread_mutex_destroy(&pool.lock);
+    stack_free(stack);
+    return;
+  }
+
+  pthread_t workers[63];
+  unsigned started = 0;
+  while (started < threads - 1 &&
+         pthread_create(&workers[started], NULL, __csm_internal_free_worker, &pool) == 0)
+    started++;
+
+  // the phases are the ranges between barriers, from the last one to the first
+  pthread_mutex_lock(&pool.lock);
+  size_t end = stack->dtor_count;
+  for (size_t phase = stack->barrier_count + 1; phase-- > 0;) {
+    size_t begin = phase > 0 ? stack->barriers[phase - 1] : 0;
+    if (begin >= end)
+      continue;
+
+    pool.begin = begin;
+    pool.next = end;
+    pthread_cond_broadcast(&pool.cond);
+    __csm_internal_free_pool_work(&pool);
+    while (pool.running > 0)
+      pthread_cond_wait(&pool.cond, &pool.lock);
+    end = begin;
+  }
+  pool.done = true;
+  pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (unsigned i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+  pthread_cond_destroy(&pool.cond);
+  pthread_mutex_destroy(&pool.lock);
+
+  stack->dtor_count = 0; // everything was already destroyed
+  stack_free(stack);
+}
+
+#ifdef CSM_ATOMICS
+static Arena *__csm_internal_map_shared_arena(int fd, size_t capacity, bool read_only) {
+  Arena *arena = (Arena *)malloc(sizeof(Arena));
+  if (arena == NULL)
+    return NULL;
+
+  arena->mapping_size = sizeof(Shared_arena_header) + capacity;
+  arena->mapping = mmap(NULL, arena->mapping_size,
+                        read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+  if (arena->mapping == MAP_FAILED) {
+    free(arena);
+    return NULL;
+  }
+
+  arena->block = (uint8_t *)arena->mapping + sizeof(Shared_arena_header);
+  arena->capacity = capacity;
+  arena->actual_size = 0;
+  arena->kind = read_only ? CSM_ARENA_SHARED_READ_ONLY : CSM_ARENA_SHARED;
+  return arena;
+}
+
+Arena *create_shared_arena(int fd, size_t capacity) {
+  if (ftruncate(fd, (off_t)(sizeof(Shared_arena_header) + capacity)) != 0)
+    return NULL;
+
+  Arena *arena = __csm_internal_map_shared_arena(fd, capacity, false);
+  if (arena == NULL)
+    return NULL;
+
+  Shared_arena_header *header = (Shared_arena_header *)arena->mapping;
+  header->header_size = sizeof(Shared_arena_header);
+  header->capacity = capacity;
+  __atomic_store_n(&header->used, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->root, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->magic, CSM_SHARED_ARENA_MAGIC, __ATOMIC_RELEASE);
+  return arena;
+}
+
+Arena *attach_shared_arena(int fd, bool read_only) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Shared_arena_header))
+    return NULL;
+
+  Shared_arena_header header;
+  if (!__csm_internal_pread_all(fd, &header, sizeof(header), 0) ||
+      header.magic != CSM_SHARED_ARENA_MAGIC ||
+      header.header_size != sizeof(Shared_arena_header) ||
+      header.capacity > (uint64_t)st.st_size - sizeof(Shared_arena_header))
+    return NULL;
+
+  Arena *arena = __csm_internal_map_shared_arena(fd, (size_t)header.capacity, read_only);
+  if (arena != NULL)
+    arena->actual_size = shared_arena_used(arena);
+  return arena;
+}
+
+bool shared_arena_set_root(Arena *arena, Dyn_off_ptr root) {
+  Dyn_off_ptr record = arena_alloc_off(arena, sizeof(Dyn_off_ptr));
+  if (record.size == 0)
+    return false;
+
+  *get_dyn_off_ptr_data(Dyn_off_ptr, arena, &record) = root;
+  Shared_arena_header *header = (Shared_arena_header *)arena->mapping;
+  __atomic_store_n(&header->root, record.offset + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+Dyn_off_ptr shared_arena_root(const Arena *arena) {
+  const Shared_arena_header *header = (const Shared_arena_header *)arena->mapping;
+  uint64_t root = __atomic_load_n(&header->root, __ATOMIC_ACQUIRE);
+  if (root == 0)
+    return (Dyn_off_ptr){.offset = 0, .size = 0};
+
+  Dyn_off_ptr record = {.offset = (size_t)root - 1, .size = sizeof(Dyn_off_ptr)};
+  return *get_dyn_off_ptr_data(Dyn_off_ptr, arena, &record);
+}
+
+size_t shared_arena_used(const Arena *arena) {
+  const Shared_arena_header *header = (const Shared_arena_header *)arena->mapping;
+  return (size_t)__atomic_load_n(&header->used, __ATOMIC_ACQUIRE);
+}
+
+// it waits a bit more on each call, first spinning then yielding and at the
+// end sleeping up to 1ms
+static void __csm_internal_backoff(unsigned *round) {
+  if (*round < 16) {
+    (*round)++;
+  } else if (*round < 32) {
+    (*round)++;
+    sched_yield();
+  } else {
+    struct timespec ts = {0, 1000000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+// the queue is the bounded MPMC queue of Dmitry Vyukov, each slot has a
+// sequence that says for what position it is free(pos) or full(pos + 1)
+static bool __csm_internal_ring_init(Csm_ring *ring, size_t depth) {
+  size_t slots = 2;
+  while (slots < depth)
+    slots *= 2;
+
+  ring->slots = (Csm_ring_slot *)malloc(slots * sizeof(Csm_ring_slot));
+  if (ring->slots == NULL)
+    return false;
+  for (size_t i = 0; i < slots; i++)
+    ring->slots[i].sequence = i;
+  ring->mask = slots - 1;
+  ring->enqueue_pos = 0;
+  ring->dequeue_pos = 0;
+  return true;
+}
+
+static bool __csm_internal_ring_push(Csm_ring *ring, uintptr_t value) {
+  size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    Csm_ring_slot *slot = &ring->slots[pos & ring->mask];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->value = value;
+        __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false; // full
+    } else {
+      pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static bool __csm_internal_ring_pop(Csm_ring *ring, uintptr_t *value) {
+  size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+  for (;;) {
+    Csm_ring_slot *slot = &ring->slots[pos & ring->mask];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *value = slot->value;
+        __atomic_store_n(&slot->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false; // empty
+    } else {
+      pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// the waits are a Dekker handshake, the sleeper writes its flag before it
+// looks at the ring again and the other side looks at the flag after it
+// changed the ring, with a fence on both sides one of them sees the other
+static void __csm_internal_reclaimer_wake(Stack_reclaimer *reclaimer, pthread_cond_t *cond) {
+  pthread_mutex_lock(&reclaimer->lock);
+  pthread_cond_broadcast(cond);
+  pthread_mutex_unlock(&reclaimer->lock);
+}
+
+static void *__csm_internal_reclaimer_thread(void *arg) {
+  Stack_reclaimer *reclaimer = (Stack_reclaimer *)arg;
+  uintptr_t value;
+  for (;;) {
+    bool popped = __csm_internal_ring_pop(&reclaimer->ring, &value);
+    if (!popped) {
+      pthread_mutex_lock(&reclaimer->lock);
+      __atomic_store_n(&reclaimer->sleeping, true, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      // stop is set after the last push so a empty queue is really empty
+      while (!(popped = __csm_internal_ring_pop(&reclaimer->ring, &value)) &&
+             !__atomic_load_n(&reclaimer->stop, __ATOMIC_ACQUIRE))
+        pthread_cond_wait(&reclaimer->ready, &reclaimer->lock);
+      __atomic_store_n(&reclaimer->sleeping, false, __ATOMIC_RELAXED);
+      pthread_mutex_unlock(&reclaimer->lock);
+      if (!popped)
+        return NULL;
+    }
+
+    // the slot is free now, a producer can be waiting for it
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&reclaimer->blocked, __ATOMIC_RELAXED) > 0)
+      __csm_internal_reclaimer_wake(reclaimer, &reclaimer->space);
+    stack_free((Ptr_stack *)value);
+  }
+}
+
+Stack_reclaimer *create_reclaimer(size_t depth) {
+  Stack_reclaimer *reclaimer = (Stack_reclaimer *)calloc(1, sizeof(Stack_reclaimer));
+  if (reclaimer == NULL)
+    return NULL;
+  if (!__csm_internal_ring_init(&reclaimer->ring, depth)) {
+    free(reclaimer);
+    return NULL;
+  }
+  pthread_mutex_init(&reclaimer->lock, NULL);
+  pthread_cond_init(&reclaimer->ready, NULL);
+  pthread_cond_init(&reclaimer->space, NULL);
+
+  if (pthread_create(&reclaimer->thread, NULL, __csm_internal_reclaimer_thread, reclaimer) != 0) {
+    pthread_cond_destroy(&reclaimer->space);
+    pthread_cond_destroy(&reclaimer->ready);
+    pthread_mutex_destroy(&reclaimer->lock);
+    free(reclaimer->ring.slots);
+    free(reclaimer);
+    return NULL;
+  }
+  return reclaimer;
+}
+
+void stack_free_async(Stack_reclaimer *reclaimer, Ptr_stack *stack) {
+  if (reclaimer == NULL) {
+    stack_free(stack);
+    return;
+  }
+
+  if (!__csm_internal_ring_push(&reclaimer->ring, (uintptr_t)stack)) {
+    // the reclaimer is behind, the producer sleeps until it takes a stack
+    pthread_mutex_lock(&reclaimer->lock);
+    __atomic_add_fetch(&reclaimer->blocked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!__csm_internal_ring_push(&reclaimer->ring, (uintptr_t)stack))
+      pthread_cond_wait(&reclaimer->space, &reclaimer->lock);
+    __atomic_sub_fetch(&reclaimer->blocked, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&reclaimer->lock);
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&reclaimer->sleeping, __ATOMIC_RELAXED))
+    __csm_internal_reclaimer_wake(reclaimer, &reclaimer->ready);
+}
+
+bool stack_enable_remote_free(Ptr_stack *stack, size_t depth) {
+  (void)depth;
+  if (stack == NULL)
+    return false;
+  if (stack->remote != NULL)
+    return true;
+
+  stack->remote = (Csm_remote *)calloc(1, sizeof(Csm_remote));
+  return stack->remote != NULL;
+}
+
+// the node is linked with a exchange on the head, so a push never waits, its
+// next is this until the pusher writes it
+#define CSM_REMOTE_PENDING ((Csm_remote_node *)1)
+
+bool stack_release_ptr_remote(Ptr_stack *stack, size_t index) {
+  if (stack == NULL || stack->remote == NULL)
+    return false;
+  Csm_remote_node *node = (Csm_remote_node *)malloc(sizeof(Csm_remote_node));
+  if (node == NULL)
+    return false;
+
+  node->value = (uintptr_t)index;
+  node->next = CSM_REMOTE_PENDING;
+  Csm_remote_node *prev = __atomic_exchange_n(&stack->remote->head, node, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&node->next, prev, __ATOMIC_RELEASE);
+  return true;
+}
+
+// the last rc releases are queued with these tags on the index, so only the
+// owner thread writes Ptr_stack::ptr_list
+#define CSM_REMOTE_RC_STRONG ((uintptr_t)1 << (sizeof(uintptr_t) * 8 - 1))
+#define CSM_REMOTE_RC_WEAK ((uintptr_t)1 << (sizeof(uintptr_t) * 8 - 2))
+#define CSM_REMOTE_TAGS (CSM_REMOTE_RC_STRONG | CSM_REMOTE_RC_WEAK)
+
+static void __csm_internal_rc_drop(Ptr_stack *stack, Dyn_ptr *dyn_ptr, uintptr_t tag);
+
+void stack_drain_remote(Ptr_stack *stack) {
+  if (stack == NULL || stack->remote == NULL)
+    return;
+
+  // the list is taken whole and turned around so the releases keep their order
+  Csm_remote_node *node = __atomic_exchange_n(&stack->remote->head, NULL, __ATOMIC_ACQUIRE);
+  Csm_remote_node *queue = NULL;
+  while (node != NULL) {
+    Csm_remote_node *next;
+    while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == CSM_REMOTE_PENDING)
+      sched_yield(); // the pusher is between its two steps
+    node->next = queue;
+    queue = node;
+    node = next;
+  }
+
+  while (queue != NULL) {
+    uintptr_t entry = queue->value;
+    Csm_remote_node *next = queue->next;
+    free(queue);
+    queue = next;
+
+    size_t index = (size_t)(entry & ~CSM_REMOTE_TAGS);
+    if (index >= stack->length)
+      continue;
+    if ((entry & CSM_REMOTE_TAGS) != 0)
+      __csm_internal_rc_drop(stack, &stack->ptr_list[index], entry & CSM_REMOTE_TAGS);
+    else
+      stack_release_ptr(stack, &stack->ptr_list[index]);
+  }
+}
+
+Stack_epoch *create_epoch(Ptr_stack *stack, unsigned readers) {
+  if (stack == NULL || readers == 0 || stack->epoch != NULL)
+    return NULL;
+
+  Stack_epoch *epoch = (Stack_epoch *)calloc(1, sizeof(Stack_epoch));
+  if (epoch == NULL)
+    return NULL;
+  epoch->readers = (Epoch_reader *)calloc(readers, sizeof(Epoch_reader));
+  if (epoch->readers == NULL) {
+    free(epoch);
+    return NULL;
+  }
+
+  epoch->stack = stack;
+  epoch->global = 1; // 0 marks the readers that are outside
+  epoch->reader_count = readers;
+  stack->epoch = epoch;
+  return epoch;
+}
+
+void epoch_enter(Stack_epoch *epoch, unsigned reader) {
+  size_t global = __atomic_load_n(&epoch->global, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&epoch->readers[reader].epoch, global, __ATOMIC_RELAXED);
+  // the announce must be visible before any read of the shared data
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(Stack_epoch *epoch, unsigned reader) {
+  __atomic_store_n(&epoch->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+bool epoch_retire(Stack_epoch *epoch, size_t index) {
+  if (epoch->retired_count == epoch->retired_capacity) {
+    size_t capacity = epoch->retired_capacity > 0 ? epoch->retired_capacity * 2 : 64;
+    Epoch_retired *retired =
+        (Epoch_retired *)realloc(epoch->retired, capacity * sizeof(Epoch_retired));
+    if (retired == NULL)
+      return false;
+    epoch->retired = retired;
+    epoch->retired_capacity = capacity;
+  }
+
+  epoch->retired[epoch->retired_count].index = index;
+  epoch->retired[epoch->retired_count].epoch = epoch->global;
+  epoch->retired_count++;
+  return true;
+}
+
+size_t epoch_collect(Stack_epoch *epoch) {
+  // the unlinks of the owner must be visible before the readers are scanned
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  size_t global = epoch->global;
+  bool quiet = true;
+  for (unsigned i = 0; i < epoch->reader_count && quiet; i++) {
+    size_t seen = __atomic_load_n(&epoch->readers[i].epoch, __ATOMIC_ACQUIRE);
+    quiet = seen == 0 || seen == global;
+  }
+  if (quiet)
+    __atomic_store_n(&epoch->global, ++global, __ATOMIC_RELEASE);
+
+  // a reader can be one epoch behind, so two epochs ago nobody sees them
+  size_t released = 0;
+  while (released < epoch->retired_count && epoch->retired[released].epoch + 2 <= global) {
+    size_t index = epoch->retired[released].index;
+    if (index < epoch->stack->length)
+      stack_release_ptr(epoch->stack, &epoch->stack->ptr_list[index]);
+    released++;
+  }
+
+  if (released > 0) {
+    epoch->retired_count -= released;
+    memmove(epoch->retired, epoch->retired + released,
+            epoch->retired_count * sizeof(Epoch_retired));
+  }
+  return released;
+}
+
+void epoch_free(Stack_epoch *epoch) {
+  if (epoch == NULL)
+    return;
+
+  unsigned round = 0;
+  while (epoch->retired_count > 0) {
+    if (epoch_collect(epoch) == 0)
+      __csm_internal_backoff(&round); // a reader is still inside
+  }
+  epoch->stack->epoch = NULL;
+  free(epoch->retired);
+  free(epoch->readers);
+  free(epoch);
+}
+
+// the header takes whole CSM_ALIGNMENT steps so the data keeps its alignment
+#define CSM_RC_HEADER_SIZE                                                     \
+  ((sizeof(Rc_header) + (CSM_ALIGNMENT - 1)) & ~(size_t)(CSM_ALIGNMENT - 1))
+
+static Rc_header *__csm_internal_rc_header(const Dyn_ptr *dyn_ptr) {
+  return (Rc_header *)((uint8_t *)dyn_ptr->ptr - CSM_RC_HEADER_SIZE);
+}
+
+// it makes room into Ptr_stack::rc_marks for the slot index, it is called by
+// the owner thread before the slot exists
+static bool __csm_internal_rc_reserve(Ptr_stack *stack, size_t index) {
+  size_t word = index / CSM_WORD_BITS;
+  if (word < stack->rc_mark_words)
+    return true;
+  size_t words = (stack->capacity + CSM_WORD_BITS - 1) / CSM_WORD_BITS;
+  if (words <= word)
+    words = word + 1;
+  size_t *marks = (size_t *)realloc(stack->rc_marks, words * sizeof(size_t));
+  if (marks == NULL)
+    return false;
+  memset(marks + stack->rc_mark_words, 0, (words - stack->rc_mark_words) * sizeof(size_t));
+  stack->rc_marks = marks;
+  stack->rc_mark_words = words;
+  return true;
+}
+
+// the bits are changed with atomics because rc_release can run on other threads
+static void __csm_internal_rc_mark(Ptr_stack *stack, size_t index, bool strong) {
+  size_t bit = (size_t)1 << (index % CSM_WORD_BITS);
+  if (strong)
+    __atomic_or_fetch(&stack->rc_marks[index / CSM_WORD_BITS], bit, __ATOMIC_RELAXED);
+  else
+    __atomic_and_fetch(&stack->rc_marks[index / CSM_WORD_BITS], ~bit, __ATOMIC_RELAXED);
+}
+
+// it tells if dyn_ptr is a slot of the stack that holds a strong reference,
+// the other Dyn_ptr's have no Rc_header or their block can be already gone
+static bool __csm_internal_is_rc(Ptr_stack *stack, const Dyn_ptr *dyn_ptr) {
+  uintptr_t slot = (uintptr_t)dyn_ptr - (uintptr_t)stack->ptr_list;
+  if (slot >= stack->length * sizeof(Dyn_ptr) || slot % sizeof(Dyn_ptr) != 0)
+    return false;
+  size_t index = slot / sizeof(Dyn_ptr);
+  if (index / CSM_WORD_BITS >= stack->rc_mark_words)
+    return false;
+  size_t word = __atomic_load_n(&stack->rc_marks[index / CSM_WORD_BITS], __ATOMIC_RELAXED);
+  return (word >> (index % CSM_WORD_BITS)) & 1;
+}
+
+Dyn_ptr *stack_new_rc(Ptr_stack *stack, void *data, size_t size) {
+  if (stack == NULL || size == 0 || size > CSM_MAX_PTR_SIZE - CSM_RC_HEADER_SIZE)
+    return NULL;
+
+  // the header must be into the arena block, so the data is never inline
+  if (!__csm_internal_rc_reserve(stack, stack->length))
+    return NULL;
+  Dyn_ptr *dyn_ptr = __csm_internal_stack_alloc(stack, size + CSM_RC_HEADER_SIZE, false);
+  if (dyn_ptr == NULL)
+    return NULL;
+  __csm_internal_rc_mark(stack, (size_t)(dyn_ptr - stack->ptr_list), true);
+
+  Rc_header *header = (Rc_header *)dyn_ptr->ptr;
+  header->strong = 1;
+  header->weak = 1; // the strong references hold one weak reference together
+  header->anchor = 0;
+  dyn_ptr->ptr = (uint8_t *)dyn_ptr->ptr + CSM_RC_HEADER_SIZE;
+  dyn_ptr->size = size;
+  if (data != NULL)
+    memcpy(dyn_ptr->ptr, data, size);
+  return dyn_ptr;
+}
+
+void rc_retain(Dyn_ptr *dyn_ptr) {
+  __atomic_add_fetch(&__csm_internal_rc_header(dyn_ptr)->strong, 1, __ATOMIC_RELAXED);
+}
+
+void rc_weak_retain(Dyn_ptr *dyn_ptr) {
+  __atomic_add_fetch(&__csm_internal_rc_header(dyn_ptr)->weak, 1, __ATOMIC_RELAXED);
+}
+
+bool rc_upgrade(Dyn_ptr *dyn_ptr) {
+  Rc_header *header = __csm_internal_rc_header(dyn_ptr);
+  size_t strong = __atomic_load_n(&header->strong, __ATOMIC_RELAXED);
+  while (strong != 0) {
+    if (__atomic_compare_exchange_n(&header->strong, &strong, strong + 1, true,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return true;
+  }
+  return false;
+}
+
+// it runs the deallocator of a block without strong references, it can be
+// kept by holder or by a Dyn_ptr that was released before
+static void __csm_internal_rc_dealloc(Ptr_stack *stack, Rc_header *header, Dyn_ptr *holder) {
+  if ((holder == NULL || !__csm_internal_has_dealloc(holder)) && header->anchor != 0 &&
+      header->anchor <= stack->length)
+    holder = &stack->ptr_list[header->anchor - 1];
+  if (holder != NULL && __csm_internal_has_dealloc(holder)) {
+    __csm_internal_get_dealloc(stack, holder)(holder);
+    __csm_internal_set_null_dealloc(holder); // stack_free must not run it again
+  }
+  header->anchor = 0;
+}
+
+// it is the owner side of the last releases, the record is rewritten here
+static void __csm_internal_rc_drop(Ptr_stack *stack, Dyn_ptr *dyn_ptr, uintptr_t tag) {
+  Rc_header *header = __csm_internal_rc_header(dyn_ptr);
+  if (tag == CSM_REMOTE_RC_STRONG) {
+    __csm_internal_rc_dealloc(stack, header, dyn_ptr);
+    if (__atomic_sub_fetch(&header->weak, 1, __ATOMIC_ACQ_REL) != 0)
+      return;
+  }
+
+  // nobody else holds the block, it is given back with its header
+  __csm_internal_stack_recycle_block(stack, header, dyn_ptr->size + CSM_RC_HEADER_SIZE);
+  dyn_ptr->ptr = NULL;
+  dyn_ptr->size = 0;
+}
+
+static void __csm_internal_rc_queue(Ptr_stack *stack, Dyn_ptr *dyn_ptr, uintptr_t tag) {
+  if (stack->remote != NULL) // without memory the block waits for stack_free
+    stack_release_ptr_remote(stack, (size_t)(dyn_ptr - stack->ptr_list) | tag);
+  else
+    __csm_internal_rc_drop(stack, dyn_ptr, tag);
+}
+
+void rc_weak_release(Ptr_stack *stack, Dyn_ptr *dyn_ptr) {
+  if (__atomic_sub_fetch(&__csm_internal_rc_header(dyn_ptr)->weak, 1, __ATOMIC_ACQ_REL) == 0)
+    __csm_internal_rc_queue(stack, dyn_ptr, CSM_REMOTE_RC_WEAK);
+}
+
+bool rc_release(Ptr_stack *stack, Dyn_ptr *dyn_ptr) {
+  if (stack == NULL || dyn_ptr == NULL || !__csm_internal_is_rc(stack, dyn_ptr))
+    return false;
+
+  // the slot keeps its data for the weak references and the deallocator but
+  // it can not be cloned, written or released again
+  Rc_header *header = __csm_internal_rc_header(dyn_ptr);
+  size_t index = (size_t)(dyn_ptr - stack->ptr_list);
+  __csm_internal_rc_mark(stack, index, false);
+  if (__csm_internal_has_dealloc(dyn_ptr)) // the last release finds it here
+    __atomic_store_n(&header->anchor, index + 1, __ATOMIC_RELAXED);
+  if (__atomic_sub_fetch(&header->strong, 1, __ATOMIC_ACQ_REL) != 0)
+    return false;
+
+  __csm_internal_rc_queue(stack, dyn_ptr, CSM_REMOTE_RC_STRONG);
+  return true;
+}
+
+size_t rc_strong_count(const Dyn_ptr *dyn_ptr) {
+  return __atomic_load_n(&__csm_internal_rc_header(dyn_ptr)->strong, __ATOMIC_RELAXED);
+}
+
+Dyn_ptr *stack_cow_clone(Ptr_stack *stack, Dyn_ptr *source) {
+  if (stack == NULL || source == NULL || source->ptr == NULL)
+    return NULL;
+  __csm_internal_stack_drain(stack);
+
+  uintptr_t slot = (uintptr_t)source - (uintptr_t)stack->ptr_list;
+  if (!__csm_internal_is_rc(stack, source) || !__csm_internal_stack_reserve(stack, 1) ||
+      !__csm_internal_rc_reserve(stack, stack->length))
+    return NULL;
+
+  source = &stack->ptr_list[slot / sizeof(Dyn_ptr)]; // the list could move
+  rc_retain(source);
+  Dyn_ptr *clone = &stack->ptr_list[stack->length];
+  clone->ptr = source->ptr;
+  clone->size = source->size;
+  __csm_internal_set_null_dealloc(clone);
+  __csm_internal_rc_mark(stack, stack->length++, true);
+  return clone;
+}
+
+void *dyn_ptr_mut(Ptr_stack *stack, Dyn_ptr *dyn_ptr) {
+  if (stack == NULL || dyn_ptr == NULL || !__csm_internal_is_rc(stack, dyn_ptr))
+    return NULL;
+  if (__atomic_load_n(&__csm_internal_rc_header(dyn_ptr)->strong, __ATOMIC_ACQUIRE) == 1)
+    return dyn_ptr->ptr; // nobody else sees the block
+
+  size_t size = dyn_ptr->size;
+  uint8_t *block = __csm_internal_stack_alloc_block(stack, size + CSM_RC_HEADER_SIZE);
+  if (block == NULL)
+    return NULL;
+
+  // the shared block is read after the allocation because the arena can move
+  Rc_header *shared = __csm_internal_rc_header(dyn_ptr);
+  Rc_header *header = (Rc_header *)block;
+  header->strong = 1;
+  header->weak = 1;
+  header->anchor = 0;
+  memcpy(block + CSM_RC_HEADER_SIZE, dyn_ptr->ptr, size);
+  dyn_ptr->ptr = block + CSM_RC_HEADER_SIZE;
+
+  // the other owners can have gone since the check
+  if (__atomic_sub_fetch(&shared->strong, 1, __ATOMIC_ACQ_REL) == 0) {
+    __csm_internal_rc_dealloc(stack, shared, NULL);
+    if (__atomic_sub_fetch(&shared->weak, 1, __ATOMIC_ACQ_REL) == 0)
+      __csm_internal_stack_recycle_block(stack, shared, size + CSM_RC_HEADER_SIZE);
+  }
+  return dyn_ptr->ptr;
+}
+
+void reclaimer_free(Stack_reclaimer *reclaimer) {
+  if (reclaimer == NULL)
+    return;
+
+  pthread_mutex_lock(&reclaimer->lock);
+  __atomic_store_n(&reclaimer->stop, true, __ATOMIC_RELEASE);
+  pthread_cond_signal(&reclaimer->ready);
+  pthread_mutex_unlock(&reclaimer->lock);
+  pthread_join(reclaimer->thread, NULL);
+  pthread_cond_destroy(&reclaimer->space);
+  pthread_cond_destroy(&reclaimer->ready);
+  pthread_mutex_destroy(&reclaimer->lock);
+  free(reclaimer->ring.slots);
+  free(reclaimer);
+}
+
+#if defined(CSM_IO_URING) && defined(__linux__)
+Uring *create_uring(unsigned entries) {
+  Uring *ring = (Uring *)calloc(1, sizeof(Uring));
+  if (ring == NULL)
+    return NULL;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    free(ring);
+    return NULL;
+  }
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size)
+      ring->sq_ring_size = ring->cq_ring_size;
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto fail_fd;
+
+  ring->cq_ring = ring->sq_ring;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+      goto fail_sq;
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto fail_cq;
+
+  uint8_t *sq = (uint8_t *)ring->sq_ring;
+  uint8_t *cq = (uint8_t *)ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return ring;
+
+fail_cq:
+  if (ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+fail_sq:
+  munmap(ring->sq_ring, ring->sq_ring_size);
+fail_fd:
+  close(ring->fd);
+  free(ring);
+  return NULL;
+}
+
+bool uring_register_arena(Uring *ring, Arena *arena) {
+  if (ring->in_flight > 0 || ring->to_submit > 0 || arena->kind != CSM_ARENA_HEAP)
+    return false;
+
+  if (ring->buffer != NULL) {
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    ring->buffer = NULL;
+    ring->buffer_size = 0;
+  }
+
+  struct iovec iov = {.iov_base = arena->block, .iov_len = arena->capacity};
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+    return false;
+
+  ring->buffer = arena->block;
+  ring->buffer_size = arena->capacity;
+  return true;
+}
+
+Dyn_ptr *uring_read(Uring *ring, Ptr_stack *stack, int fd, size_t size,
+                    uint64_t offset) {
+  if (size > UINT32_MAX ||
+      ring->to_submit + ring->in_flight >= ring->sq_entries)
+    return NULL;
+
+  // growing the arena would move the block under the reads in flight
+  Arena *arena = stack->arena;
+  if (ring->to_submit + ring->in_flight > 0 &&
+      arena->capacity - arena->actual_size < size + CSM_ALIGNMENT)
+    return NULL;
+
+  // inline Dyn_ptr's are outside of the registered buffer
+  Dyn_ptr *dyn_ptr = __csm_internal_stack_alloc(stack, size, false);
+  if (dyn_ptr == NULL)
+    return NULL;
+
+  if ((ring->buffer != arena->block || ring->buffer_size != arena->capacity) &&
+      !uring_register_arena(ring, arena)) {
+    __csm_internal_stack_trim_last(stack, 0);
+    return NULL;
+  }
+
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = (uint64_t)(uintptr_t)dyn_ptr->ptr;
+  sqe->len = (uint32_t)size;
+  sqe->buf_index = 0;
+  sqe->user_data = (uint64_t)(stack->length - 1);
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+  return dyn_ptr;
+}
+
+int uring_submit_and_wait(Uring *ring, Ptr_stack *stack, unsigned wait_nr) {
+  if (wait_nr > ring->to_submit + ring->in_flight)
+    wait_nr = ring->to_submit + ring->in_flight;
+
+  long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_nr,
+                           wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (submitted < 0)
+    return -errno;
+  ring->to_submit -= (unsigned)submitted;
+  ring->in_flight += (unsigned)submitted;
+
+  int reaped = 0;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    if (cqe->user_data < stack->length)
+      stack->ptr_list[cqe->user_data].size = cqe->res > 0 ? (size_t)cqe->res : 0;
+    ring->in_flight--;
+    reaped++;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return reaped;
+}
+
+void uring_free(Uring *ring) {
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+  free(ring);
 }
+#endif // CSM_IO_URING
+#endif // CSM_ATOMICS
+#endif // CSM_POSIX
 #endif
 
 #ifdef CSM_AUTO
@@ -370,7 +4465,7 @@ Dyn_ptr *__csm_internal_ctx_alloc(void *data, size_t size) {
 }
 
 void __csm_internal_ctx_insert_dealloc(Dyn_ptr *dyn_ptr, void (*dealloc)(Dyn_ptr *)) {
-  dyn_ptr_insert_deallocator(dyn_ptr, dealloc);
+  stack_insert_deallocator(__csm_internal_stack, dyn_ptr, dealloc);
 }
 
 void __csm_internal_stack_free(void) {
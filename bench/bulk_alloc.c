@@ -0,0 +1,74 @@
+// It compares the per item cost of stack_new_ptrs with a loop of
+// stack_new_ptr, each round fills a new warm stack whose arena has room for
+// all the payloads so only the allocations are timed
+//
+// usage: bench_bulk_alloc [items] [payload size] [rounds]
+#define _POSIX_C_SOURCE 200809L
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static Ptr_stack *bench_stack(size_t items, size_t size) {
+  Ptr_stack *stack = create_stack(items);
+  if (stack == NULL || !arena_realloc(stack->arena, items * (size + CSM_ALIGNMENT))) {
+    fprintf(stderr, "no memory\n");
+    exit(1);
+  }
+  // the pages are touched first so the page faults are not timed
+  memset(stack->arena->block, 0, stack->arena->capacity);
+  return stack;
+}
+
+int main(int argc, char **argv) {
+  size_t items = argc > 1 ? (size_t)atol(argv[1]) : 10000;
+  size_t size = argc > 2 ? (size_t)atol(argv[2]) : 8;
+  int rounds = argc > 3 ? atoi(argv[3]) : 500;
+
+  uint8_t *payloads = (uint8_t *)malloc(items * size);
+  struct iovec *iov = (struct iovec *)malloc(items * sizeof(struct iovec));
+  if (payloads == NULL || iov == NULL) {
+    fprintf(stderr, "no memory\n");
+    return 1;
+  }
+  memset(payloads, 'p', items * size);
+  for (size_t i = 0; i < items; i++) {
+    iov[i].iov_base = payloads + i * size;
+    iov[i].iov_len = size;
+  }
+
+  double single = 0, bulk = 0;
+  for (int round = 0; round < rounds; round++) {
+    Ptr_stack *stack = bench_stack(items, size);
+    double start = now_ns();
+    for (size_t i = 0; i < items; i++)
+      stack_new_ptr(stack, iov[i].iov_base, size);
+    single += now_ns() - start;
+    stack_free(stack);
+
+    stack = bench_stack(items, size);
+    start = now_ns();
+    if (!stack_new_ptrs(stack, iov, items, NULL)) {
+      fprintf(stderr, "stack_new_ptrs failed\n");
+      return 1;
+    }
+    bulk += now_ns() - start;
+    stack_free(stack);
+  }
+
+  double total = (double)items * rounds;
+  printf("%zu payloads of %zu B, %d rounds\n", items, size, rounds);
+  printf("stack_new_ptr:  %.2f ns/item\n", single / total);
+  printf("stack_new_ptrs: %.2f ns/item\n", bulk / total);
+  free(iov);
+  free(payloads);
+  return 0;
+}
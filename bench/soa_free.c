@@ -0,0 +1,72 @@
+// It compares the teardown of Ptr_stack_soa(stack_soa_free) with the one of
+// Ptr_stack(stack_free), both hold the same entries and a part of them has a
+// deallocator, the timings include releasing the arrays and the arena
+//
+// usage: bench_soa_free [entries] [payload size] [percent with deallocator]
+#define _POSIX_C_SOURCE 200809L
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t runs;
+
+static void count_deallocator(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  runs++;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  size_t entries = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+  size_t size = argc > 2 ? (size_t)atol(argv[2]) : 16;
+  size_t percent = argc > 3 ? (size_t)atol(argv[3]) : 1;
+  size_t every = percent > 0 ? 100 / percent : 0;
+
+  uint8_t payload[256] = {0};
+  if (size == 0 || size > sizeof(payload)) {
+    fprintf(stderr, "the payload size must be from 1 to %zu\n", sizeof(payload));
+    return 1;
+  }
+
+  Ptr_stack *stack = create_stack(entries);
+  Ptr_stack_soa *soa = create_stack_soa(entries);
+  if (stack == NULL || soa == NULL) {
+    fprintf(stderr, "no memory\n");
+    return 1;
+  }
+  for (size_t i = 0; i < entries; i++) {
+    Dyn_ptr *dyn_ptr = stack_new_ptr(stack, payload, size);
+    size_t index = stack_soa_new_ptr(soa, payload, size);
+    if (dyn_ptr == NULL || index == SIZE_MAX) {
+      fprintf(stderr, "no memory\n");
+      return 1;
+    }
+    if (every > 0 && i % every == 0) {
+      stack_insert_deallocator(stack, dyn_ptr, count_deallocator);
+      stack_soa_insert_deallocator(soa, index, count_deallocator);
+    }
+  }
+
+  runs = 0;
+  double start = now_ns();
+  stack_free(stack);
+  double aos = now_ns() - start;
+  size_t aos_runs = runs;
+
+  runs = 0;
+  start = now_ns();
+  stack_soa_free(soa);
+  double soa_ns = now_ns() - start;
+
+  printf("%zu entries of %zu B, %zu deallocators\n", entries, size, aos_runs);
+  printf("stack_free:     %.2f ns/entry\n", aos / (double)entries);
+  printf("stack_soa_free: %.2f ns/entry (%zu deallocators)\n", soa_ns / (double)entries, runs);
+  return 0;
+}
@@ -0,0 +1,119 @@
+// It compares uring_read with pread into stack_alloc_uninit, both read a page
+// cached temporary file in blocks into the arena of a Ptr_stack
+//
+// usage: bench_uring_read [file MiB] [block size] [queue depth]
+#define _GNU_SOURCE
+#define CSM_IO_URING
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// the arena gets room for the whole file so it never moves under the reads
+static Ptr_stack *bench_stack(size_t reads, size_t file_size) {
+  Ptr_stack *stack = create_stack(reads);
+  if (stack == NULL || !arena_realloc(stack->arena, file_size + reads * CSM_ALIGNMENT)) {
+    fprintf(stderr, "no memory\n");
+    exit(1);
+  }
+  return stack;
+}
+
+static double bench_pread(int fd, size_t file_size, size_t block) {
+  size_t reads = file_size / block;
+  Ptr_stack *stack = bench_stack(reads, file_size);
+
+  double start = now_ns();
+  for (size_t i = 0; i < reads; i++) {
+    Dyn_ptr *dyn_ptr = stack_alloc_uninit(stack, block);
+    if (pread(fd, dyn_ptr->ptr, block, (off_t)(i * block)) != (ssize_t)block) {
+      fprintf(stderr, "pread failed\n");
+      exit(1);
+    }
+  }
+  double elapsed = now_ns() - start;
+
+  stack_free(stack);
+  return elapsed / (double)reads;
+}
+
+static double bench_uring(int fd, size_t file_size, size_t block, unsigned depth) {
+  size_t reads = file_size / block;
+  Ptr_stack *stack = bench_stack(reads, file_size);
+  Uring *ring = create_uring(depth);
+  if (ring == NULL) {
+    fprintf(stderr, "io_uring is not available\n");
+    exit(1);
+  }
+
+  double start = now_ns();
+  size_t queued = 0;
+  while (queued < reads) {
+    unsigned batch = 0;
+    for (; batch < depth && queued < reads; batch++, queued++) {
+      if (uring_read(ring, stack, fd, block, (uint64_t)(queued * block)) == NULL) {
+        fprintf(stderr, "uring_read failed\n");
+        exit(1);
+      }
+    }
+    for (unsigned done = 0; done < batch;) {
+      int reaped = uring_submit_and_wait(ring, stack, batch - done);
+      if (reaped < 0) {
+        fprintf(stderr, "uring_submit_and_wait failed: %d\n", reaped);
+        exit(1);
+      }
+      done += (unsigned)reaped;
+    }
+  }
+  double elapsed = now_ns() - start;
+
+  for (size_t i = 0; i < reads; i++) {
+    if (stack->ptr_list[i].size != block) {
+      fprintf(stderr, "short read at block %zu\n", i);
+      exit(1);
+    }
+  }
+  uring_free(ring);
+  stack_free(stack);
+  return elapsed / (double)reads;
+}
+
+int main(int argc, char **argv) {
+  size_t file_size = (size_t)(argc > 1 ? atol(argv[1]) : 64) << 20;
+  size_t block = argc > 2 ? (size_t)atol(argv[2]) : 4096;
+  unsigned depth = argc > 3 ? (unsigned)atoi(argv[3]) : 64;
+
+  char path[] = "/tmp/csm_uring_benchXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  unlink(path);
+
+  // it writes the file so its pages are into the page cache
+  char *chunk = (char *)malloc(1 << 20);
+  memset(chunk, 'c', 1 << 20);
+  for (size_t written = 0; written < file_size; written += 1 << 20) {
+    if (write(fd, chunk, 1 << 20) != 1 << 20) {
+      perror("write");
+      return 1;
+    }
+  }
+  free(chunk);
+
+  printf("%zu MiB in %zu B blocks, queue depth %u\n", file_size >> 20, block, depth);
+  printf("pread:      %.1f ns/read\n", bench_pread(fd, file_size, block));
+  printf("uring_read: %.1f ns/read\n", bench_uring(fd, file_size, block, depth));
+  close(fd);
+  return 0;
+}
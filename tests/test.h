@@ -0,0 +1,16 @@
+#ifndef CSM_TEST_H
+#define CSM_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// it stops the test with the failed condition and its line
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#endif // CSM_TEST_H
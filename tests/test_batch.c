@@ -0,0 +1,80 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#define MANY (CSM_BATCH_SIZE + 44)
+
+static int values[MANY + 16]; // the values in the order they are destroyed
+static size_t destroyed;
+static size_t calls[8]; // the count of every batch call
+static size_t call_count;
+
+// plain_a and plain_b have batch functions so they never run alone
+static void plain_a(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  CHECK(false);
+}
+
+static void plain_b(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  CHECK(false);
+}
+
+static void plain_c(Dyn_ptr *dyn_ptr) {
+  values[destroyed++] = *get_dyn_ptr_data(int, dyn_ptr);
+  calls[call_count++] = 0;
+}
+
+static void batch(Dyn_ptr **dyn_ptrs, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    values[destroyed++] = *get_dyn_ptr_data(int, dyn_ptrs[i]);
+  calls[call_count++] = count;
+}
+
+static void wrong_batch(Dyn_ptr **dyn_ptrs, size_t count) {
+  (void)dyn_ptrs;
+  (void)count;
+  CHECK(false);
+}
+
+static void push(Ptr_stack *stack, int value, void (*dealloc)(Dyn_ptr *)) {
+  Dyn_ptr *dyn_ptr = stack_new_ptr(stack, &value, sizeof(value));
+  stack_insert_deallocator(stack, dyn_ptr, dealloc);
+}
+
+// the consecutive Dyn_ptr's of a batched deallocator are destroyed together
+// in LIFO order, a other deallocator or CSM_BATCH_SIZE splits the batch
+static void test_groups(void) {
+  Ptr_stack *stack = create_stack(16);
+  CHECK(stack_register_batch_deallocator(stack, plain_a, wrong_batch));
+  CHECK(stack_register_batch_deallocator(stack, plain_b, batch));
+  CHECK(stack_register_batch_deallocator(stack, plain_a, batch)); // it replaces it
+  CHECK(stack->group_count == 2);
+  CHECK(!stack_register_batch_deallocator(stack, plain_c, NULL));
+
+  int value = 0;
+  for (int i = 0; i < MANY; i++)
+    push(stack, value++, plain_a);
+  push(stack, value++, plain_b);
+  push(stack, value++, plain_b);
+  push(stack, value++, plain_c);
+  for (int i = 0; i < 3; i++)
+    push(stack, value++, plain_a);
+
+  destroyed = 0;
+  call_count = 0;
+  stack_free(stack);
+  CHECK(destroyed == (size_t)value);
+  for (int i = 0; i < value; i++)
+    CHECK(values[i] == value - 1 - i);
+
+  size_t expected[] = {3, 0, 2, CSM_BATCH_SIZE, MANY - CSM_BATCH_SIZE};
+  CHECK(call_count == sizeof(expected) / sizeof(expected[0]));
+  for (size_t i = 0; i < call_count; i++)
+    CHECK(calls[i] == expected[i]);
+}
+
+int main(void) {
+  test_groups();
+  return 0;
+}
@@ -0,0 +1,182 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+static int runs;
+
+static void count_deallocator(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  runs++;
+}
+
+// a slot whose deallocator is set, cleared and set again is visited once
+static void test_reset_deallocator(void) {
+  Ptr_stack *stack = create_stack(16);
+  int value = 1;
+  Dyn_ptr *dyn_ptr = stack_new_ptr(stack, &value, sizeof(value));
+  stack_insert_deallocator(stack, dyn_ptr, count_deallocator);
+  stack_insert_deallocator(stack, dyn_ptr, NULL);
+  stack_insert_deallocator(stack, dyn_ptr, count_deallocator);
+  CHECK(stack->dtor_count == 1);
+
+  runs = 0;
+  stack_free(stack);
+  CHECK(runs == 1);
+}
+
+// a released slot that gets a deallocator again is visited once
+static void test_release_then_deallocator(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[32] = "payload";
+  Dyn_ptr *dyn_ptr = stack_new_ptr(stack, data, sizeof(data));
+  stack_insert_deallocator(stack, dyn_ptr, count_deallocator);
+
+  runs = 0;
+  stack_release_ptr(stack, dyn_ptr);
+  CHECK(runs == 1);
+  stack_insert_deallocator(stack, dyn_ptr, count_deallocator);
+  CHECK(stack->dtor_count == 1);
+  stack_free(stack);
+  CHECK(runs == 2);
+}
+
+// the deallocators inserted without the stack are found by stack_free
+static void test_insert_without_stack(void) {
+  Ptr_stack *stack = create_stack(16);
+  int value = 1;
+  for (int i = 0; i < 8; i++) {
+    Dyn_ptr *dyn_ptr = stack_new_ptr(stack, &value, sizeof(value));
+    if (i % 2 == 0)
+      dyn_ptr_insert_deallocator(dyn_ptr, count_deallocator);
+  }
+  stack_insert_deallocator(stack, &stack->ptr_list[0], count_deallocator);
+  CHECK(stack->dtor_count == 4);
+
+  runs = 0;
+  stack_free(stack);
+  CHECK(runs == 4);
+}
+
+static int order[8];
+
+static void order_deallocator(Dyn_ptr *dyn_ptr) {
+  order[runs++] = *get_dyn_ptr_data(int, dyn_ptr);
+}
+
+// both ways to insert a deallocator keep the LIFO order and the barriers
+static void test_mixed_order(void) {
+  Ptr_stack *stack = create_stack(2);
+  for (int i = 0; i < 4; i++) {
+    size_t index = stack_new_ptr(stack, &i, sizeof(i)) - stack->ptr_list;
+    if (i % 2 == 0)
+      dyn_ptr_insert_deallocator(&stack->ptr_list[index], order_deallocator);
+    else
+      stack_insert_deallocator(stack, &stack->ptr_list[index], order_deallocator);
+    if (i == 1)
+      CHECK(stack_free_barrier(stack));
+  }
+
+  runs = 0;
+  CHECK(!stack_free_step(stack, 2));
+  CHECK(runs == 2 && order[0] == 3 && order[1] == 2);
+  CHECK(stack_free_step(stack, 2));
+  CHECK(runs == 4 && order[2] == 1 && order[3] == 0);
+}
+
+static void free_deallocator(Dyn_ptr *dyn_ptr) {
+  free(dyn_ptr->ptr);
+  runs++;
+}
+
+// the adopted buffers are not copied, they outlive the growth of the stack
+// and their deallocator runs on release or on stack_free
+static void test_adopt(void) {
+  Ptr_stack *stack = create_stack(16);
+  char *buffers[8];
+  for (int i = 0; i < 8; i++) {
+    buffers[i] = malloc(64);
+    snprintf(buffers[i], 64, "buffer %d", i);
+    Dyn_ptr *dyn_ptr = stack_adopt_ptr(stack, buffers[i], 64, free_deallocator);
+    CHECK(dyn_ptr != NULL && dyn_ptr->ptr == buffers[i] && dyn_ptr->size == 64);
+  }
+  int owned = 7;
+  CHECK(stack_adopt_ptr(stack, &owned, sizeof(owned), NULL) != NULL);
+  CHECK(stack_adopt_ptr(stack, NULL, 1, free_deallocator) == NULL);
+  CHECK(stack->length == 9 && stack->dtor_count == 8);
+  CHECK(stack->arena->actual_size == 0);
+
+  for (int i = 0; i < 8; i++)
+    CHECK(stack->ptr_list[i].ptr == buffers[i]);
+  Dyn_ptr *borrowed = &stack->ptr_list[8];
+  CHECK(*get_dyn_ptr_data(int, borrowed) == 7);
+
+  runs = 0;
+  CHECK(stack_release_ptr(stack, &stack->ptr_list[3]));
+  CHECK(runs == 1);
+  stack_free(stack);
+  CHECK(runs == 8 && owned == 7);
+}
+
+#define STEPPED 200
+
+static int stepped[STEPPED];
+
+static void step_deallocator(Dyn_ptr *dyn_ptr) {
+  stepped[runs++] = *get_dyn_ptr_data(int, dyn_ptr);
+}
+
+static Ptr_stack *stepped_stack(void) {
+  Ptr_stack *stack = create_stack(16);
+  for (int i = 0; i < STEPPED; i++) {
+    Dyn_ptr *dyn_ptr = stack_new_ptr(stack, &i, sizeof(i));
+    stack_insert_deallocator(stack, dyn_ptr, step_deallocator);
+  }
+  runs = 0;
+  return stack;
+}
+
+// every call of stack_free_step resumes where the last one stopped
+static void test_free_step_resume(void) {
+  Ptr_stack *stack = stepped_stack();
+  CHECK(!stack_free_step(stack, 0));
+  CHECK(runs == 0);
+
+  size_t calls = 0;
+  while (!stack_free_step(stack, 7)) {
+    calls++;
+    CHECK(runs == (int)calls * 7);
+    CHECK(stack->dtor_count == (size_t)(STEPPED - runs));
+  }
+  CHECK(calls == STEPPED / 7);
+  CHECK(runs == STEPPED);
+  for (int i = 0; i < STEPPED; i++)
+    CHECK(stepped[i] == STEPPED - 1 - i);
+
+  CHECK(stack_free_step(create_stack(16), 1)); // nothing to destroy
+}
+
+// a exhausted budget still makes progress and a big one finishes at once
+static void test_free_step_timed(void) {
+  Ptr_stack *stack = stepped_stack();
+  int calls = 0;
+  while (!stack_free_step_timed(stack, 0))
+    calls++;
+  CHECK(calls > 0 && runs == STEPPED);
+  for (int i = 0; i < STEPPED; i++)
+    CHECK(stepped[i] == STEPPED - 1 - i);
+
+  stack = stepped_stack();
+  CHECK(stack_free_step_timed(stack, UINT64_C(10000000000)));
+  CHECK(runs == STEPPED);
+}
+
+int main(void) {
+  test_free_step_resume();
+  test_free_step_timed();
+  test_adopt();
+  test_insert_without_stack();
+  test_mixed_order();
+  test_reset_deallocator();
+  test_release_then_deallocator();
+  return 0;
+}
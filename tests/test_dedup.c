@@ -0,0 +1,76 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+static void clear_deallocator(Dyn_ptr *dyn_ptr) {
+  memset(dyn_ptr->ptr, 0, dyn_ptr->size);
+}
+
+// a deallocator that changes the payload does not hide that the block is
+// still shared
+static void test_deallocator_changes_payload(void) {
+  Ptr_stack *stack = create_stack(16);
+  stack_enable_dedup(stack, 16);
+  char data[64] = "a payload that is shared by two Dyn_ptr's";
+  size_t first = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  size_t second = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  CHECK(stack->ptr_list[first].ptr == stack->ptr_list[second].ptr);
+  CHECK(stack_dedup_stats(stack).hits == 1);
+
+  stack_insert_deallocator(stack, &stack->ptr_list[first], clear_deallocator);
+  stack_release_ptr(stack, &stack->ptr_list[first]);
+
+  // the block must not be handed out while second still points to it
+  char other[64] = "another payload of the same size";
+  Dyn_ptr *fresh = stack_new_ptr(stack, other, sizeof(other));
+  CHECK(fresh->ptr != stack->ptr_list[second].ptr);
+  stack_free(stack);
+}
+
+// the block is reused once its last share is released
+static void test_last_share_reuses_block(void) {
+  Ptr_stack *stack = create_stack(16);
+  stack_enable_dedup(stack, 16);
+  char data[64] = "a payload that is shared by two Dyn_ptr's";
+  size_t first = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  size_t second = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  void *block = stack->ptr_list[first].ptr;
+
+  stack_release_ptr(stack, &stack->ptr_list[first]);
+  stack_release_ptr(stack, &stack->ptr_list[second]);
+  CHECK(stack->dedup_count == 0);
+
+  char other[64] = "another payload of the same size";
+  CHECK(stack_new_ptr(stack, other, sizeof(other))->ptr == block);
+  CHECK(stack_new_ptr(stack, data, sizeof(data))->ptr != block);
+  stack_free(stack);
+}
+
+// the shares survive the growth of the tables
+static void test_many_payloads(void) {
+  Ptr_stack *stack = create_stack(16);
+  stack_enable_dedup(stack, 16);
+  uint64_t data[4] = {0};
+  for (uint64_t i = 0; i < 200; i++) {
+    data[0] = i;
+    stack_new_ptr(stack, data, sizeof(data));
+    stack_new_ptr(stack, data, sizeof(data));
+  }
+  CHECK(stack->dedup_count == 200);
+  for (size_t i = 0; i < stack->length; i += 2)
+    stack_release_ptr(stack, &stack->ptr_list[i]);
+  CHECK(stack->dedup_count == 200);
+  for (size_t i = 1; i < stack->length; i += 2)
+    stack_release_ptr(stack, &stack->ptr_list[i]);
+  CHECK(stack->dedup_count == 0);
+  stack_free(stack);
+}
+
+int main(void) {
+  test_deallocator_changes_payload();
+  test_last_share_reuses_block();
+  test_many_payloads();
+  return 0;
+}
@@ -0,0 +1,89 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#define READERS 2
+#define WRITES 20000
+
+static Stack_epoch *epoch;
+static size_t current; // the index of the Dyn_ptr that the readers see
+static size_t base;
+static int done;
+
+static void *reader_thread(void *arg) {
+  unsigned reader = (unsigned)(uintptr_t)arg;
+  size_t last = 0;
+  while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+    epoch_enter(epoch, reader);
+    size_t index = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    Dyn_ptr *dyn_ptr = &epoch->stack->ptr_list[index];
+    size_t value = *get_dyn_ptr_data(size_t, dyn_ptr);
+    // a released block would be reused by a later value
+    CHECK(value == index - base);
+    CHECK(value >= last);
+    last = value;
+    epoch_exit(epoch, reader);
+  }
+  return NULL;
+}
+
+// the readers always see live data while the owner replaces and retires it,
+// the stack is big enough so it never grows
+static void test_readers_and_writer(void) {
+  Ptr_stack *stack = create_stack(2 * WRITES * sizeof(size_t)); // for the list and the arena
+  Dyn_ptr *list = stack->ptr_list;
+  epoch = create_epoch(stack, READERS);
+  CHECK(epoch != NULL);
+  CHECK(create_epoch(stack, READERS) == NULL);
+
+  size_t value = 0;
+  base = (size_t)(stack_new_ptr(stack, &value, sizeof(value)) - stack->ptr_list);
+  current = base;
+  pthread_t readers[READERS];
+  for (uintptr_t i = 0; i < READERS; i++)
+    CHECK(pthread_create(&readers[i], NULL, reader_thread, (void *)i) == 0);
+
+  for (value = 1; value < WRITES; value++) {
+    size_t index = (size_t)(stack_new_ptr(stack, &value, sizeof(value)) - stack->ptr_list);
+    CHECK(index == base + value);
+    size_t old = __atomic_exchange_n(&current, index, __ATOMIC_ACQ_REL);
+    CHECK(epoch_retire(epoch, old));
+    epoch_collect(epoch);
+  }
+  __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < READERS; i++)
+    CHECK(pthread_join(readers[i], NULL) == 0);
+
+  CHECK(stack->ptr_list == list);
+  epoch_free(epoch);
+  CHECK(stack->epoch == NULL);
+  for (size_t i = base; i < base + WRITES - 1; i++)
+    CHECK(stack->ptr_list[i].ptr == NULL);
+  stack_free(stack);
+}
+
+// a retired Dyn_ptr is released after the epoch advanced twice and not before
+static void test_retire_after_advance(void) {
+  Ptr_stack *stack = create_stack(16);
+  epoch = create_epoch(stack, 1);
+  size_t value = 1;
+  stack_new_ptr(stack, &value, sizeof(value));
+  CHECK(epoch_retire(epoch, 0));
+
+  epoch_enter(epoch, 0); // the reader can see the retired Dyn_ptr
+  CHECK(epoch_collect(epoch) == 0);
+  CHECK(epoch_collect(epoch) == 0);
+  CHECK(stack->ptr_list[0].ptr != NULL);
+  epoch_exit(epoch, 0);
+
+  CHECK(epoch_collect(epoch) == 1);
+  CHECK(stack->ptr_list[0].ptr == NULL);
+  epoch_free(epoch);
+  stack_free(stack);
+}
+
+int main(void) {
+  test_readers_and_writer();
+  test_retire_after_advance();
+  return 0;
+}
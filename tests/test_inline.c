@@ -0,0 +1,60 @@
+#ifndef CSM_INLINE_SIZE
+#define CSM_INLINE_SIZE 16
+#endif
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+// the payloads of CSM_INLINE_SIZE bytes stay into the record and one more
+// byte goes to the arena, for every way to create a Dyn_ptr
+static void test_boundary(void) {
+  Ptr_stack *stack = create_stack(256);
+  char data[CSM_INLINE_SIZE + 1];
+  memset(data, 'i', sizeof(data));
+
+  Dyn_ptr *small = stack_new_ptr(stack, data, CSM_INLINE_SIZE);
+  CHECK(small->ptr == small->inline_data && small->size == CSM_INLINE_SIZE);
+  CHECK(stack->arena->actual_size == 0);
+  Dyn_ptr *big = stack_new_ptr(stack, data, CSM_INLINE_SIZE + 1);
+  CHECK(big->ptr == stack->arena->block && big->size == CSM_INLINE_SIZE + 1);
+  CHECK(memcmp(big->ptr, data, sizeof(data)) == 0);
+  size_t used = stack->arena->actual_size;
+  CHECK(used >= CSM_INLINE_SIZE + 1);
+
+  small = stack_alloc_uninit(stack, CSM_INLINE_SIZE);
+  CHECK(small->ptr == small->inline_data && stack->arena->actual_size == used);
+  big = stack_alloc_uninit(stack, CSM_INLINE_SIZE + 1);
+  CHECK(big->ptr != big->inline_data && stack->arena->actual_size > used);
+  used = stack->arena->actual_size;
+
+  struct iovec iov[2] = {{data, CSM_INLINE_SIZE}, {data, CSM_INLINE_SIZE + 1}};
+  Dyn_ptr *pair = NULL;
+  CHECK(stack_new_ptrs(stack, iov, 2, &pair));
+  CHECK(pair[0].ptr == pair[0].inline_data);
+  CHECK(pair[1].ptr != pair[1].inline_data && stack->arena->actual_size > used);
+  CHECK(memcmp(pair[0].ptr, data, CSM_INLINE_SIZE) == 0);
+  CHECK(memcmp(pair[1].ptr, data, CSM_INLINE_SIZE + 1) == 0);
+  stack_free(stack);
+}
+
+// the inline payloads follow their records when Ptr_stack::ptr_list moves
+static void test_list_growth(void) {
+  Ptr_stack *stack = create_stack(16);
+  for (int i = 0; i < 1000; i++)
+    stack_new_ptr(stack, &i, sizeof(i));
+  CHECK(stack->arena->actual_size == 0);
+  for (int i = 0; i < 1000; i++) {
+    Dyn_ptr *dyn_ptr = &stack->ptr_list[i];
+    CHECK(dyn_ptr->ptr == dyn_ptr->inline_data);
+    CHECK(*get_dyn_ptr_data(int, dyn_ptr) == i);
+  }
+  stack_free(stack);
+}
+
+int main(void) {
+  test_boundary();
+  test_list_growth();
+  return 0;
+}
@@ -0,0 +1,88 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// it opens a empty file that is gone when it is closed
+static int temp_fd(void) {
+  char path[] = "/tmp/csm_internXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  unlink(path);
+  return fd;
+}
+
+// the same bytes give the same pointer and it does not move while more
+// strings are interned and the arena grows
+static void test_unique_and_stable(void) {
+  Ptr_stack *stack = create_stack(16);
+  const char *hello = csm_intern(stack, "hello", 5);
+  CHECK(hello != NULL && strcmp(hello, "hello") == 0);
+  CHECK(csm_intern(stack, "hello world", 5) == hello);
+  CHECK(csm_intern(stack, "help", 4) != hello);
+
+  char name[32];
+  const char *names[2000];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(name, sizeof(name), "name %d", i);
+    names[i] = csm_intern(stack, name, strlen(name));
+    CHECK(names[i] != NULL);
+    stack_new_ptr(stack, name, sizeof(name));
+  }
+  for (int i = 0; i < 2000; i++) {
+    snprintf(name, sizeof(name), "name %d", i);
+    CHECK(csm_intern(stack, name, strlen(name)) == names[i]);
+    CHECK(strcmp(names[i], name) == 0);
+  }
+  CHECK(csm_intern(stack, "hello", 5) == hello);
+  CHECK(strcmp(hello, "hello") == 0);
+  stack_free(stack);
+}
+
+// stack_writev only writes the interned bytes of a chunk
+static void test_writev_used_part(void) {
+  Ptr_stack *stack = create_stack(16);
+  csm_intern(stack, "hello", 5);
+  csm_intern(stack, "bye", 3);
+
+  int fd = temp_fd();
+  CHECK(stack_writev(stack, fd, (Stack_range){0, stack->length}) == 10);
+  char out[16];
+  CHECK(pread(fd, out, sizeof(out), 0) == 10);
+  CHECK(memcmp(out, "hello\0bye\0", 10) == 0);
+  close(fd);
+  stack_free(stack);
+}
+
+// the chunks are written as empty Dyn_ptr's and the other ones are kept
+static void test_snapshot_skips_chunks(void) {
+  Ptr_stack *stack = create_stack(16);
+  int value = 7;
+  stack_new_ptr(stack, &value, sizeof(value));
+  csm_intern(stack, "hello", 5);
+  stack_new_ptr(stack, &value, sizeof(value));
+
+  int fd = temp_fd();
+  CHECK(stack_snapshot(stack, fd));
+  size_t length = stack->length;
+  stack_free(stack);
+
+  Ptr_stack *restored = stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE);
+  CHECK(restored != NULL);
+  CHECK(restored->length == length);
+  CHECK(*(int *)restored->ptr_list[0].ptr == 7);
+  CHECK(*(int *)restored->ptr_list[length - 1].ptr == 7);
+  for (size_t i = 1; i < length - 1; i++)
+    CHECK(restored->ptr_list[i].ptr == NULL && restored->ptr_list[i].size == 0);
+  stack_free(restored);
+  close(fd);
+}
+
+int main(void) {
+  test_unique_and_stable();
+  test_writev_used_part();
+  test_snapshot_skips_chunks();
+  return 0;
+}
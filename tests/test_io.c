@@ -0,0 +1,132 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORDS 3000 // more than a batch of iovec's
+
+static int temp_fd(void) {
+  char path[] = "/tmp/csm_ioXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  unlink(path);
+  return fd;
+}
+
+// the record i has i % 7 bytes, the empty ones are skipped by stack_writev
+static size_t push_records(Ptr_stack *stack) {
+  size_t total = 0;
+  for (size_t i = 0; i < RECORDS; i++) {
+    char record[8];
+    size_t size = i % 7;
+    memset(record, 'a' + (int)(i % 26), sizeof(record));
+    if (size == 0)
+      CHECK(stack_new_ptrs(stack, &(struct iovec){record, 0}, 1, NULL));
+    else
+      CHECK(stack_new_ptr(stack, record, size) != NULL);
+    total += size;
+  }
+  return total;
+}
+
+static void check_records(int fd, size_t start, size_t end, size_t total) {
+  char *out = malloc(total + 1);
+  CHECK(pread(fd, out, total + 1, 0) == (ssize_t)total);
+  size_t at = 0;
+  for (size_t i = start; i < end; i++)
+    for (size_t j = 0; j < i % 7; j++)
+      CHECK(out[at++] == 'a' + (int)(i % 26));
+  CHECK(at == total);
+  free(out);
+}
+
+// a range longer than CSM_IOV_BATCH is written in several writev calls
+// without losing or reordering any byte
+static void test_writev_batches(void) {
+  Ptr_stack *stack = create_stack(16);
+  size_t total = push_records(stack);
+
+  int fd = temp_fd();
+  CHECK(stack_writev(stack, fd, (Stack_range){0, RECORDS}) == (ssize_t)total);
+  check_records(fd, 0, RECORDS, total);
+  close(fd);
+  stack_free(stack);
+}
+
+// the range is clamped to Ptr_stack::length
+static void test_writev_range(void) {
+  Ptr_stack *stack = create_stack(16);
+  push_records(stack);
+
+  size_t total = 0;
+  for (size_t i = 1500; i < RECORDS; i++)
+    total += i % 7;
+  int fd = temp_fd();
+  CHECK(stack_writev(stack, fd, (Stack_range){1500, SIZE_MAX}) == (ssize_t)total);
+  check_records(fd, 1500, RECORDS, total);
+  close(fd);
+
+  fd = temp_fd();
+  CHECK(stack_writev(stack, fd, (Stack_range){RECORDS, 10}) == 0);
+  CHECK(stack_writev(stack, -1, (Stack_range){0, RECORDS}) == -1);
+  close(fd);
+  stack_free(stack);
+}
+
+// it writes 1300 bytes into the pipe in pieces of 100 and closes it
+static void *slow_writer(void *arg) {
+  int fd = *(int *)arg;
+  char piece[100];
+  for (int i = 0; i < 13; i++) {
+    memset(piece, '0' + i, sizeof(piece));
+    CHECK(write(fd, piece, sizeof(piece)) == (ssize_t)sizeof(piece));
+    nanosleep(&(struct timespec){0, 1000000}, NULL);
+  }
+  close(fd);
+  return NULL;
+}
+
+// stack_read_fd keeps reading after short reads, the end of file trims the
+// Dyn_ptr and its arena space, and a stream that already ended gives NULL
+static void test_read_fd(void) {
+  Ptr_stack *stack = create_stack(16);
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  pthread_t writer;
+  pthread_create(&writer, NULL, slow_writer, &fds[1]);
+
+  Dyn_ptr *full = stack_read_fd(stack, fds[0], 1000);
+  CHECK(full != NULL && full->size == 1000);
+  for (int i = 0; i < 1000; i++)
+    CHECK(((char *)full->ptr)[i] == '0' + i / 100);
+
+  size_t used = stack->arena->actual_size;
+  Dyn_ptr *rest = stack_read_fd(stack, fds[0], 1000);
+  CHECK(rest != NULL && rest->size == 300);
+  CHECK(memcmp(rest->ptr, "::::", 4) == 0 && ((char *)rest->ptr)[299] == '<');
+  CHECK(stack->arena->actual_size <= used + 300 + CSM_ALIGNMENT);
+  pthread_join(writer, NULL);
+
+  size_t length = stack->length;
+  used = stack->arena->actual_size;
+  CHECK(stack_read_fd(stack, fds[0], 1000) == NULL);
+  // only the padding that aligned the trimmed Dyn_ptr is kept
+  CHECK(stack->length == length && stack->arena->actual_size < used + CSM_ALIGNMENT);
+  used = stack->arena->actual_size;
+
+  errno = 0;
+  CHECK(stack_read_fd(stack, -1, 1000) == NULL && errno == EBADF);
+  CHECK(stack->length == length && stack->arena->actual_size == used);
+  close(fds[0]);
+  stack_free(stack);
+}
+
+int main(void) {
+  test_read_fd();
+  test_writev_batches();
+  test_writev_range();
+  return 0;
+}
@@ -0,0 +1,153 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+#include <sys/uio.h>
+
+// it fills the arena so the next allocation has to grow it
+static void fill_arena(Ptr_stack *stack) {
+  size_t filler[8] = {0}; // each one is different so the dedup mode copies it
+  while (stack->arena->capacity - stack->arena->actual_size >= 2 * sizeof(filler)) {
+    filler[0]++;
+    stack_new_ptr(stack, filler, sizeof(filler));
+  }
+}
+
+// the data of a Dyn_ptr is copied right when the copy grows the arena
+static void test_copy_of_arena_data(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[256];
+  memset(data, 'x', sizeof(data));
+  size_t source = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  fill_arena(stack);
+
+  uint8_t *old_block = stack->arena->block;
+  Dyn_ptr *copy = stack_new_ptr(stack, stack->ptr_list[source].ptr, sizeof(data));
+  CHECK(copy != NULL);
+  CHECK(stack->arena->block != old_block || stack->arena->capacity > sizeof(data));
+  CHECK(memcmp(copy->ptr, data, sizeof(data)) == 0);
+  CHECK(memcmp(stack->ptr_list[source].ptr, data, sizeof(data)) == 0);
+  stack_free(stack);
+}
+
+static void test_copies_of_arena_data(void) {
+  Ptr_stack *stack = create_stack(16);
+  char first[256], second[300];
+  memset(first, 'a', sizeof(first));
+  memset(second, 'b', sizeof(second));
+  size_t a = (size_t)(stack_new_ptr(stack, first, sizeof(first)) - stack->ptr_list);
+  size_t b = (size_t)(stack_new_ptr(stack, second, sizeof(second)) - stack->ptr_list);
+  fill_arena(stack);
+
+  struct iovec iov[2] = {{stack->ptr_list[a].ptr, sizeof(first)},
+                         {stack->ptr_list[b].ptr, sizeof(second)}};
+  Dyn_ptr *copies = NULL;
+  CHECK(stack_new_ptrs(stack, iov, 2, &copies));
+  CHECK(memcmp(copies[0].ptr, first, sizeof(first)) == 0);
+  CHECK(memcmp(copies[1].ptr, second, sizeof(second)) == 0);
+  stack_free(stack);
+}
+
+#define BATCH 100
+
+// one batch grows Ptr_stack::ptr_list and the arena, every payload keeps its
+// size and bytes and the empty ones have no data
+static void test_new_ptrs_batch(void) {
+  Ptr_stack *stack = create_stack(16);
+  int first = 42;
+  stack_new_ptr(stack, &first, sizeof(first));
+
+  static char payloads[BATCH][BATCH];
+  struct iovec iov[BATCH];
+  for (size_t i = 0; i < BATCH; i++) {
+    memset(payloads[i], (int)i, sizeof(payloads[i]));
+    iov[i].iov_base = payloads[i];
+    iov[i].iov_len = i % 10 == 0 ? 0 : i; // the sizes cross CSM_INLINE_SIZE
+  }
+
+  Dyn_ptr *dyn_ptrs = NULL;
+  CHECK(stack_new_ptrs(stack, iov, BATCH, &dyn_ptrs));
+  CHECK(stack->length == BATCH + 1 && dyn_ptrs == &stack->ptr_list[1]);
+  for (size_t i = 0; i < BATCH; i++) {
+    CHECK(dyn_ptrs[i].size == iov[i].iov_len);
+    if (iov[i].iov_len == 0) {
+      CHECK(dyn_ptrs[i].ptr == NULL);
+      continue;
+    }
+    CHECK(memcmp(dyn_ptrs[i].ptr, payloads[i], iov[i].iov_len) == 0);
+    CHECK((uintptr_t)dyn_ptrs[i].ptr % CSM_ALIGNMENT == 0);
+  }
+  Dyn_ptr *head = &stack->ptr_list[0];
+  CHECK(*get_dyn_ptr_data(int, head) == 42);
+
+  CHECK(stack_new_ptrs(stack, NULL, 0, NULL));
+  CHECK(stack->length == BATCH + 1);
+  stack_free(stack);
+}
+
+static void test_dedup_copy_of_arena_data(void) {
+  Ptr_stack *stack = create_stack(16);
+  stack_enable_dedup(stack, 16);
+  char data[256];
+  memset(data, 'x', sizeof(data));
+  Dyn_off_ptr source = stack_new_off_ptr(stack, data, sizeof(data));
+  fill_arena(stack);
+
+  // the payload is only into the arena, not into the table
+  data[0] = 'y';
+  Dyn_ptr *copy = stack_new_ptr(stack, stack->arena->block + source.offset, sizeof(data));
+  CHECK(copy != NULL);
+  CHECK(((char *)copy->ptr)[0] == 'x' && ((char *)copy->ptr)[255] == 'x');
+  stack_free(stack);
+}
+
+// dyn_ptr_alloc reads its data after the arena grows
+static void test_dyn_ptr_alloc_of_arena_data(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[256];
+  memset(data, 'x', sizeof(data));
+  size_t source = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  fill_arena(stack);
+
+  Dyn_ptr copy = {0};
+  dyn_ptr_alloc(stack, &copy, stack->ptr_list[source].ptr, sizeof(data));
+  CHECK(copy.ptr != NULL && copy.size == sizeof(data));
+  CHECK(memcmp(copy.ptr, data, sizeof(data)) == 0);
+  stack_free(stack);
+}
+
+#if defined(CSM_COMPACT_DYN_PTR) && SIZE_MAX > UINT32_MAX
+// the sizes that do not fit into Dyn_ptr::size are rejected before anything
+// is allocated or read
+static void test_too_big(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[16] = "data";
+  size_t big = (size_t)UINT32_MAX + 1;
+  CHECK(stack_alloc_uninit(stack, big) == NULL);
+  CHECK(stack_new_ptr(stack, data, big) == NULL);
+  CHECK(stack_adopt_ptr(stack, data, big, NULL) == NULL);
+  struct iovec iov[2] = {{data, sizeof(data)}, {data, big}};
+  CHECK(!stack_new_ptrs(stack, iov, 2, NULL));
+  CHECK(stack_read_fd(stack, -1, big) == NULL);
+  CHECK(stack->length == 0);
+
+  Dyn_ptr dyn_ptr = {0};
+  dyn_ptr_alloc(stack, &dyn_ptr, data, big);
+  CHECK(dyn_ptr.ptr == NULL && dyn_ptr.size == 0);
+  CHECK(stack->arena->actual_size == 0);
+  stack_free(stack);
+}
+#endif
+
+int main(void) {
+  test_copy_of_arena_data();
+  test_copies_of_arena_data();
+  test_dedup_copy_of_arena_data();
+  test_dyn_ptr_alloc_of_arena_data();
+  test_new_ptrs_batch();
+#if defined(CSM_COMPACT_DYN_PTR) && SIZE_MAX > UINT32_MAX
+  test_too_big();
+#endif
+  return 0;
+}
@@ -0,0 +1,67 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+typedef struct {
+  Rel_ptr next;
+  int value;
+} Node;
+
+// a list linked with Rel_ptr's and found with a Dyn_off_ptr keeps working in
+// a copy of the block at other address
+static void test_copy_of_arena(void) {
+  Arena *arena = create_arena(256);
+  Dyn_off_ptr first = arena_alloc_off(arena, sizeof(Node));
+  Dyn_off_ptr second = arena_alloc_off(arena, sizeof(Node));
+  CHECK(first.size == sizeof(Node) && second.size == sizeof(Node));
+  Node *a = get_dyn_off_ptr_data(Node, arena, &first);
+  Node *b = get_dyn_off_ptr_data(Node, arena, &second);
+  a->value = 1;
+  b->value = 2;
+  rel_ptr_set(&a->next, b);
+  rel_ptr_set(&b->next, NULL);
+  CHECK(rel_ptr_get(&a->next) == b && rel_ptr_get(&b->next) == NULL);
+
+  Arena *clone = arena_clone(arena);
+  CHECK(clone != NULL && clone->block != arena->block);
+  uint8_t *copy = (uint8_t *)malloc(arena->actual_size);
+  memcpy(copy, arena->block, arena->actual_size);
+  memset(arena->block, 0, arena->actual_size); // nothing points into the old block
+  arena_free(arena);
+
+  Node *node = get_dyn_off_ptr_data(Node, clone, &first);
+  CHECK(node->value == 1);
+  node = (Node *)rel_ptr_get(&node->next);
+  CHECK(node == get_dyn_off_ptr_data(Node, clone, &second) && node->value == 2);
+  CHECK(rel_ptr_get(&node->next) == NULL);
+
+  node = (Node *)(copy + first.offset);
+  node = (Node *)rel_ptr_get(&node->next);
+  CHECK(node == (Node *)(copy + second.offset) && node->value == 2);
+  free(copy);
+  arena_free(clone);
+}
+
+// the offsets keep valid when the block moves because the arena grows
+static void test_arena_growth(void) {
+  Arena *arena = create_arena(sizeof(Node));
+  Dyn_off_ptr first = arena_alloc_off(arena, sizeof(Node));
+  get_dyn_off_ptr_data(Node, arena, &first)->value = 7;
+  CHECK(arena_alloc_off(arena, sizeof(Node)).size == 0);
+  CHECK(arena_realloc(arena, 1 << 20));
+  Dyn_off_ptr second = arena_alloc_off(arena, sizeof(Node));
+  CHECK(second.size == sizeof(Node));
+  rel_ptr_set(&get_dyn_off_ptr_data(Node, arena, &second)->next,
+              get_dyn_off_ptr_data(Node, arena, &first));
+  Node *node = (Node *)rel_ptr_get(&get_dyn_off_ptr_data(Node, arena, &second)->next);
+  CHECK(node->value == 7);
+  arena_free(arena);
+}
+
+int main(void) {
+  test_copy_of_arena();
+  test_arena_growth();
+  return 0;
+}
@@ -0,0 +1,62 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+#define PHASES 3
+
+static const int phase_sizes[PHASES] = {5000, 3000, 2500};
+static int remaining[PHASES]; // the records of every phase that still exist
+static unsigned char runs[10500]; // how many times every record was destroyed
+
+typedef struct {
+  int phase;
+  int id;
+} Record;
+
+static void record_deallocator(Dyn_ptr *dyn_ptr) {
+  Record *record = get_dyn_ptr_data(Record, dyn_ptr);
+  // a phase starts only when the ones after its barrier are finished
+  for (int later = record->phase + 1; later < PHASES; later++)
+    CHECK(__atomic_load_n(&remaining[later], __ATOMIC_SEQ_CST) == 0);
+  __atomic_fetch_add(&runs[record->id], 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_sub(&remaining[record->phase], 1, __ATOMIC_SEQ_CST);
+}
+
+static int push_phases(Ptr_stack *stack) {
+  int id = 0;
+  for (int phase = 0; phase < PHASES; phase++) {
+    if (phase > 0)
+      CHECK(stack_free_barrier(stack));
+    remaining[phase] = phase_sizes[phase];
+    for (int i = 0; i < phase_sizes[phase]; i++) {
+      Record record = {phase, id++};
+      Dyn_ptr *dyn_ptr = stack_new_ptr(stack, &record, sizeof(record));
+      stack_insert_deallocator(stack, dyn_ptr, record_deallocator);
+    }
+  }
+  memset(runs, 0, sizeof(runs));
+  return id;
+}
+
+// every deallocator runs once and the barriers order the phases, with
+// enough Dyn_ptr's that the workers split them in chunks
+static void test_barriers(unsigned threads) {
+  Ptr_stack *stack = create_stack(16);
+  int count = push_phases(stack);
+  CHECK(stack->dtor_count > 2 * CSM_FREE_CHUNK);
+
+  stack_free_parallel(stack, threads);
+  for (int phase = 0; phase < PHASES; phase++)
+    CHECK(remaining[phase] == 0);
+  for (int i = 0; i < count; i++)
+    CHECK(runs[i] == 1);
+}
+
+int main(void) {
+  test_barriers(4);
+  test_barriers(64 + 1); // it is clamped to 64
+  test_barriers(1);
+  return 0;
+}
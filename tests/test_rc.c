@@ -0,0 +1,140 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+static int runs;
+
+static void count_deallocator(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  runs++;
+}
+
+// the deallocator of source runs once when the clone is released last and
+// stack_free does not run it again on the reused block
+static void test_source_released_first(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[32] = "shared";
+  Dyn_ptr *source = stack_new_rc(stack, data, sizeof(data));
+  stack_insert_deallocator(stack, source, count_deallocator);
+  size_t source_index = (size_t)(source - stack->ptr_list);
+  size_t clone_index = (size_t)(stack_cow_clone(stack, source) - stack->ptr_list);
+
+  runs = 0;
+  CHECK(!rc_release(stack, &stack->ptr_list[source_index]));
+  CHECK(runs == 0);
+  CHECK(rc_release(stack, &stack->ptr_list[clone_index]));
+  CHECK(runs == 1);
+
+  Dyn_ptr *reused = stack_new_rc(stack, NULL, sizeof(data));
+  CHECK(reused != NULL);
+  stack_free(stack);
+  CHECK(runs == 1);
+}
+
+static void test_clone_released_first(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[32] = "shared";
+  Dyn_ptr *source = stack_new_rc(stack, data, sizeof(data));
+  stack_insert_deallocator(stack, source, count_deallocator);
+  size_t source_index = (size_t)(source - stack->ptr_list);
+  size_t clone_index = (size_t)(stack_cow_clone(stack, source) - stack->ptr_list);
+
+  runs = 0;
+  CHECK(!rc_release(stack, &stack->ptr_list[clone_index]));
+  CHECK(runs == 0);
+  CHECK(rc_release(stack, &stack->ptr_list[source_index]));
+  CHECK(runs == 1);
+  stack_free(stack);
+  CHECK(runs == 1);
+}
+
+// a clone that is written gets its own block and the shared one keeps the
+// deallocator of source
+static void test_clone_written(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[32] = "shared";
+  Dyn_ptr *source = stack_new_rc(stack, data, sizeof(data));
+  stack_insert_deallocator(stack, source, count_deallocator);
+  size_t source_index = (size_t)(source - stack->ptr_list);
+  size_t clone_index = (size_t)(stack_cow_clone(stack, source) - stack->ptr_list);
+
+  char *written = (char *)dyn_ptr_mut(stack, &stack->ptr_list[clone_index]);
+  CHECK(written != NULL);
+  written[0] = 'S';
+  CHECK(((char *)stack->ptr_list[source_index].ptr)[0] == 's');
+
+  runs = 0;
+  CHECK(rc_release(stack, &stack->ptr_list[clone_index]));
+  CHECK(runs == 0);
+  CHECK(rc_release(stack, &stack->ptr_list[source_index]));
+  CHECK(runs == 1);
+  stack_free(stack);
+  CHECK(runs == 1);
+}
+
+// the writes of a clone do not reach the source and the source can be
+// written after the clone got its own block
+static void test_clone_mutate(void) {
+  Ptr_stack *stack = create_stack(16);
+  int value = 1;
+  size_t source = (size_t)(stack_new_rc(stack, &value, sizeof(value)) - stack->ptr_list);
+  size_t clone = (size_t)(stack_cow_clone(stack, &stack->ptr_list[source]) - stack->ptr_list);
+  CHECK(stack->ptr_list[clone].ptr == stack->ptr_list[source].ptr);
+
+  *get_dyn_ptr_mut(int, stack, &stack->ptr_list[clone]) = 2;
+  CHECK(stack->ptr_list[clone].ptr != stack->ptr_list[source].ptr);
+  CHECK(*(int *)stack->ptr_list[source].ptr == 1);
+  CHECK(*(int *)stack->ptr_list[clone].ptr == 2);
+  CHECK(rc_strong_count(&stack->ptr_list[source]) == 1);
+
+  int *source_data = get_dyn_ptr_mut(int, stack, &stack->ptr_list[source]);
+  CHECK(source_data == stack->ptr_list[source].ptr); // nothing is shared now
+  *source_data = 3;
+  CHECK(*(int *)stack->ptr_list[clone].ptr == 2);
+  stack_free(stack);
+}
+
+// the Dyn_ptr's without a strong reference are rejected
+static void test_not_rc(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[64] = "plain";
+  size_t plain = (size_t)(stack_new_ptr(stack, data, sizeof(data)) - stack->ptr_list);
+  int value = 1;
+  size_t small = (size_t)(stack_new_ptr(stack, &value, sizeof(value)) - stack->ptr_list);
+  size_t adopted = (size_t)(stack_adopt_ptr(stack, data, sizeof(data), NULL) - stack->ptr_list);
+  Dyn_ptr outside = {0};
+  outside.ptr = data;
+  outside.size = sizeof(data);
+
+  size_t indexes[3] = {plain, small, adopted};
+  for (int i = 0; i < 3; i++) {
+    size_t length = stack->length;
+    CHECK(stack_cow_clone(stack, &stack->ptr_list[indexes[i]]) == NULL);
+    CHECK(dyn_ptr_mut(stack, &stack->ptr_list[indexes[i]]) == NULL);
+    CHECK(!rc_release(stack, &stack->ptr_list[indexes[i]]));
+    CHECK(stack->length == length);
+  }
+  CHECK(stack_cow_clone(stack, &outside) == NULL);
+  CHECK(dyn_ptr_mut(stack, &outside) == NULL);
+
+  // a released Dyn_ptr does not own the block anymore
+  size_t source = (size_t)(stack_new_rc(stack, data, sizeof(data)) - stack->ptr_list);
+  size_t clone = (size_t)(stack_cow_clone(stack, &stack->ptr_list[source]) - stack->ptr_list);
+  CHECK(!rc_release(stack, &stack->ptr_list[source]));
+  CHECK(!rc_release(stack, &stack->ptr_list[source]));
+  CHECK(stack_cow_clone(stack, &stack->ptr_list[source]) == NULL);
+  CHECK(dyn_ptr_mut(stack, &stack->ptr_list[source]) == NULL);
+  CHECK(rc_release(stack, &stack->ptr_list[clone]));
+  CHECK(stack->ptr_list[clone].ptr == NULL);
+  CHECK(stack_cow_clone(stack, &stack->ptr_list[clone]) == NULL);
+  stack_free(stack);
+}
+
+int main(void) {
+  test_source_released_first();
+  test_clone_released_first();
+  test_clone_written();
+  test_clone_mutate();
+  test_not_rc();
+  return 0;
+}
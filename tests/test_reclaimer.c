@@ -0,0 +1,109 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <time.h>
+
+static int gate; // the first deallocator waits until it is 1
+static int freed;
+
+static void gate_deallocator(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  while (!__atomic_load_n(&gate, __ATOMIC_ACQUIRE))
+    sched_yield();
+  __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+}
+
+static void count_deallocator(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+}
+
+static Ptr_stack *new_stack(void (*dealloc)(Dyn_ptr *)) {
+  Ptr_stack *stack = create_stack(16);
+  int value = 1;
+  Dyn_ptr *dyn_ptr = stack_new_ptr(stack, &value, sizeof(value));
+  CHECK(stack_insert_deallocator(stack, dyn_ptr, dealloc));
+  return stack;
+}
+
+static void sleep_ms(long ms) {
+  struct timespec ts = {0, ms * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+// the reclaimer thread sleeps while there is nothing to free
+static void test_idle_sleeps(void) {
+  Stack_reclaimer *reclaimer = create_reclaimer(4);
+  CHECK(reclaimer != NULL);
+  clockid_t clock;
+  CHECK(pthread_getcpuclockid(reclaimer->thread, &clock) == 0);
+  sleep_ms(10);
+  struct timespec before, after;
+  CHECK(clock_gettime(clock, &before) == 0);
+  sleep_ms(100);
+  CHECK(clock_gettime(clock, &after) == 0);
+  long used = (after.tv_sec - before.tv_sec) * 1000000000L + (after.tv_nsec - before.tv_nsec);
+  CHECK(used < 10 * 1000000L);
+
+  freed = 0;
+  stack_free_async(reclaimer, new_stack(count_deallocator));
+  reclaimer_free(reclaimer);
+  CHECK(freed == 1);
+}
+
+typedef struct {
+  Stack_reclaimer *reclaimer;
+  Ptr_stack *stack;
+} Async_args;
+
+static void *producer_thread(void *arg) {
+  Async_args *args = (Async_args *)arg;
+  stack_free_async(args->reclaimer, args->stack); // the queue is full
+  return NULL;
+}
+
+static void *shutdown_thread(void *arg) {
+  reclaimer_free((Stack_reclaimer *)arg);
+  return NULL;
+}
+
+// a producer sleeps while the queue is full and the shutdown with a full
+// queue frees every stack and joins the thread
+static void test_full_queue(void) {
+  freed = 0;
+  gate = 0;
+  Stack_reclaimer *reclaimer = create_reclaimer(2);
+  CHECK(reclaimer != NULL);
+  stack_free_async(reclaimer, new_stack(gate_deallocator));
+  while (__atomic_load_n(&reclaimer->ring.dequeue_pos, __ATOMIC_ACQUIRE) == 0)
+    sched_yield(); // the reclaimer took the first stack and waits at the gate
+  stack_free_async(reclaimer, new_stack(count_deallocator));
+  stack_free_async(reclaimer, new_stack(count_deallocator));
+
+  Async_args args = {reclaimer, new_stack(count_deallocator)};
+  pthread_t producer;
+  CHECK(pthread_create(&producer, NULL, producer_thread, &args) == 0);
+  while (__atomic_load_n(&reclaimer->blocked, __ATOMIC_ACQUIRE) == 0)
+    sched_yield();
+  __atomic_store_n(&gate, 1, __ATOMIC_RELEASE);
+  CHECK(pthread_join(producer, NULL) == 0);
+
+  // the queue is filled again before the shutdown
+  gate = 0;
+  stack_free_async(reclaimer, new_stack(gate_deallocator));
+  stack_free_async(reclaimer, new_stack(count_deallocator));
+  stack_free_async(reclaimer, new_stack(count_deallocator));
+  pthread_t shutdown;
+  CHECK(pthread_create(&shutdown, NULL, shutdown_thread, reclaimer) == 0);
+  sleep_ms(10);
+  __atomic_store_n(&gate, 1, __ATOMIC_RELEASE);
+  CHECK(pthread_join(shutdown, NULL) == 0);
+  CHECK(freed == 7);
+}
+
+int main(void) {
+  test_idle_sleeps();
+  test_full_queue();
+  return 0;
+}
@@ -0,0 +1,124 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#define RELEASES 10000
+
+static int runs;
+
+static void count_deallocator(Dyn_ptr *dyn_ptr) {
+  (void)dyn_ptr;
+  runs++; // it runs on the owner thread
+}
+
+typedef struct {
+  Ptr_stack *stack;
+  size_t first;
+  size_t count;
+} Remote_args;
+
+static void *release_thread(void *arg) {
+  Remote_args *args = (Remote_args *)arg;
+  for (size_t i = 0; i < args->count; i++)
+    CHECK(stack_release_ptr_remote(args->stack, args->first + i));
+  return NULL;
+}
+
+// a stack without the queue rejects the remote releases
+static void test_not_enabled(void) {
+  Ptr_stack *stack = create_stack(16);
+  int value = 1;
+  stack_new_ptr(stack, &value, sizeof(value));
+  CHECK(!stack_release_ptr_remote(stack, 0));
+  CHECK(!stack_release_ptr_remote(NULL, 0));
+  stack_free(stack);
+}
+
+// a other thread releases while the owner keeps allocating, nothing waits
+// for the owner and every release is done once
+static void test_two_threads(void) {
+  Ptr_stack *stack = create_stack(16);
+  CHECK(stack_enable_remote_free(stack, 4));
+  char data[32] = "released by the other thread";
+  for (int i = 0; i < RELEASES; i++) {
+    Dyn_ptr *dyn_ptr = stack_new_ptr(stack, data, sizeof(data));
+    CHECK(stack_insert_deallocator(stack, dyn_ptr, count_deallocator));
+  }
+
+  runs = 0;
+  Remote_args args = {stack, 0, RELEASES};
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, release_thread, &args) == 0);
+  int value = 2;
+  for (int i = 0; i < 1000; i++)
+    CHECK(stack_new_ptr(stack, &value, sizeof(value)) != NULL);
+  CHECK(pthread_join(thread, NULL) == 0);
+
+  stack_drain_remote(stack);
+  CHECK(runs == RELEASES);
+  for (int i = 0; i < RELEASES; i++)
+    CHECK(stack->ptr_list[i].ptr == NULL);
+  stack_free(stack);
+  CHECK(runs == RELEASES);
+}
+
+// the queue is drained by the calls that do not take a block from the arena
+static void test_drain_without_block(void) {
+  Ptr_stack *stack = create_stack(16);
+  CHECK(stack_enable_remote_free(stack, 0));
+  char data[32] = "payload";
+  Dyn_ptr *dyn_ptr = stack_new_ptr(stack, data, sizeof(data));
+  CHECK(stack_insert_deallocator(stack, dyn_ptr, count_deallocator));
+
+  runs = 0;
+  Remote_args args = {stack, 0, 1};
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, release_thread, &args) == 0);
+  CHECK(pthread_join(thread, NULL) == 0);
+  CHECK(runs == 0);
+  CHECK(stack_adopt_ptr(stack, data, sizeof(data), NULL) != NULL);
+  CHECK(runs == 1);
+
+  args.first = 1;
+  CHECK(pthread_create(&thread, NULL, release_thread, &args) == 0);
+  CHECK(pthread_join(thread, NULL) == 0);
+  CHECK(stack->ptr_list[1].ptr == data);
+  CHECK(stack_new_ptr(stack, data, sizeof(data)) != NULL);
+  CHECK(stack->ptr_list[1].ptr == NULL);
+  stack_free(stack);
+}
+
+static void *rc_release_thread(void *arg) {
+  Remote_args *args = (Remote_args *)arg;
+  CHECK(rc_release(args->stack, &args->stack->ptr_list[args->first]));
+  return NULL;
+}
+
+// the last rc release on a other thread runs the deallocator on the owner
+static void test_rc_remote(void) {
+  Ptr_stack *stack = create_stack(16);
+  CHECK(stack_enable_remote_free(stack, 0));
+  int value = 1;
+  Dyn_ptr *dyn_ptr = stack_new_rc(stack, &value, sizeof(value));
+  CHECK(stack_insert_deallocator(stack, dyn_ptr, count_deallocator));
+
+  runs = 0;
+  Remote_args args = {stack, 0, 1};
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, rc_release_thread, &args) == 0);
+  CHECK(pthread_join(thread, NULL) == 0);
+  CHECK(runs == 0);
+  stack_drain_remote(stack);
+  CHECK(runs == 1);
+  CHECK(stack->ptr_list[0].ptr == NULL);
+  stack_free(stack);
+  CHECK(runs == 1);
+}
+
+int main(void) {
+  test_not_enabled();
+  test_two_threads();
+  test_drain_without_block();
+  test_rc_remote();
+  return 0;
+}
@@ -0,0 +1,90 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+#include <sys/wait.h>
+
+#define CHILD_ALLOCS 1000
+
+static int temp_fd(void) {
+  char path[] = "/tmp/csm_sharedXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  unlink(path);
+  return fd;
+}
+
+static void wait_child(pid_t pid) {
+  int status;
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// a child process attaches, allocates at the same time as the parent and
+// publishes a root that the parent reads at its own address
+static void test_parent_child(void) {
+  int fd = temp_fd();
+  Arena *arena = create_shared_arena(fd, 1 << 20);
+  CHECK(arena != NULL);
+
+  pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (pid == 0) {
+    Arena *child = attach_shared_arena(fd, false);
+    CHECK(child != NULL);
+    for (int i = 0; i < CHILD_ALLOCS; i++)
+      CHECK(arena_alloc_off(child, 16).size == 16);
+    Dyn_off_ptr message = arena_alloc_off(child, 32);
+    CHECK(message.size == 32);
+    strcpy(get_dyn_off_ptr_data(char, child, &message), "from the child");
+    CHECK(shared_arena_set_root(child, message));
+    arena_free(child);
+    _exit(0);
+  }
+
+  for (int i = 0; i < CHILD_ALLOCS; i++)
+    CHECK(arena_alloc_off(arena, 16).size == 16);
+  wait_child(pid);
+
+  Dyn_off_ptr root = shared_arena_root(arena);
+  CHECK(root.size == 32);
+  CHECK(strcmp(get_dyn_off_ptr_data(char, arena, &root), "from the child") == 0);
+  // both processes took their blocks from the same bump pointer
+  CHECK(shared_arena_used(arena) >= (size_t)2 * CHILD_ALLOCS * 16 + 32 + sizeof(Dyn_off_ptr));
+  arena_free(arena);
+  close(fd);
+}
+
+// a read only attach sees the data but every write is rejected
+static void test_read_only(void) {
+  int fd = temp_fd();
+  Arena *arena = create_shared_arena(fd, 4096);
+  Dyn_off_ptr value = arena_alloc_off(arena, sizeof(int));
+  *get_dyn_off_ptr_data(int, arena, &value) = 42;
+  CHECK(shared_arena_set_root(arena, value));
+
+  Arena *reader = attach_shared_arena(fd, true);
+  CHECK(reader != NULL);
+  Dyn_off_ptr root = shared_arena_root(reader);
+  CHECK(*get_dyn_off_ptr_data(int, reader, &root) == 42);
+  size_t used = shared_arena_used(reader);
+  CHECK(arena_alloc_off(reader, 16).size == 0);
+  CHECK(arena_alloc(reader, 16).block == NULL);
+  CHECK(!shared_arena_set_root(reader, root));
+  CHECK(!arena_realloc(reader, 4096));
+  CHECK(shared_arena_used(arena) == used);
+  arena_free(reader);
+
+  int empty = temp_fd();
+  CHECK(attach_shared_arena(empty, false) == NULL); // not a shared arena
+  close(empty);
+  arena_free(arena);
+  close(fd);
+}
+
+int main(void) {
+  test_parent_child();
+  test_read_only();
+  return 0;
+}
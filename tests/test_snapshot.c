@@ -0,0 +1,121 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+// it opens a empty file that is gone when it is closed
+static int temp_fd(void) {
+  char path[] = "/tmp/csm_snapshotXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  unlink(path);
+  return fd;
+}
+
+// the snapshot is written from offset 0 even if fd was already written
+static void test_snapshot_ignores_position(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[64] = "a payload into the arena";
+  stack_new_ptr(stack, data, sizeof(data));
+  int value = 7;
+  stack_new_ptr(stack, &value, sizeof(value));
+
+  int fd = temp_fd();
+  CHECK(write(fd, "junk", 4) == 4);
+  CHECK(stack_snapshot(stack, fd));
+  stack_free(stack);
+
+  Ptr_stack *restored = stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE);
+  CHECK(restored != NULL);
+  CHECK(restored->length == 2);
+  CHECK(memcmp(restored->ptr_list[0].ptr, data, sizeof(data)) == 0);
+  CHECK(*(int *)restored->ptr_list[1].ptr == 7);
+  stack_free(restored);
+  close(fd);
+}
+
+// the file Dyn_ptr's are skipped, mapped or not, and the indexes are kept
+static void test_snapshot_skips_file_ptrs(void) {
+  int file = temp_fd();
+  CHECK(write(file, "file data", 9) == 9);
+
+  Ptr_stack *stack = create_stack(16);
+  CHECK(stack_new_file_ptr(stack, file, 0, 9) != NULL);
+  Dyn_ptr *mapped = stack_new_file_ptr(stack, file, 0, 9);
+  CHECK(get_dyn_file_data(char, mapped) != NULL);
+  char data[32] = "into the arena";
+  stack_new_ptr(stack, data, sizeof(data));
+
+  int fd = temp_fd();
+  CHECK(stack_snapshot(stack, fd));
+  stack_free(stack);
+
+  Ptr_stack *restored = stack_restore(fd, CSM_RESTORE_READ_ONLY);
+  CHECK(restored != NULL);
+  CHECK(restored->length == 3);
+  CHECK(restored->ptr_list[0].ptr == NULL && restored->ptr_list[0].size == 0);
+  CHECK(restored->ptr_list[1].ptr == NULL && restored->ptr_list[1].size == 0);
+  CHECK(memcmp(restored->ptr_list[2].ptr, data, sizeof(data)) == 0);
+  stack_free(restored);
+  close(fd);
+  close(file);
+}
+
+// a snapshot cut at any point or with a bad header is rejected
+static void test_truncated(void) {
+  Ptr_stack *stack = create_stack(16);
+  char data[4096];
+  memset(data, 'x', sizeof(data));
+  stack_new_ptr(stack, data, sizeof(data));
+  int fd = temp_fd();
+  CHECK(stack_snapshot(stack, fd));
+  stack_free(stack);
+
+  struct stat st;
+  CHECK(fstat(fd, &st) == 0);
+  off_t cuts[] = {0, 8, (off_t)sizeof(Stack_snapshot_header), 40, st.st_size / 2, st.st_size - 1};
+  for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+    int copy = temp_fd();
+    char buffer[16384];
+    CHECK(st.st_size <= (off_t)sizeof(buffer));
+    CHECK(pread(fd, buffer, (size_t)cuts[i], 0) == cuts[i]);
+    CHECK(pwrite(copy, buffer, (size_t)cuts[i], 0) == cuts[i]);
+    CHECK(stack_restore(copy, CSM_RESTORE_COPY_ON_WRITE) == NULL);
+    close(copy);
+  }
+
+  Stack_snapshot_header header;
+  CHECK(pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header));
+  Stack_snapshot_header bad = header;
+  bad.length = UINT64_MAX / 16;
+  CHECK(pwrite(fd, &bad, sizeof(bad), 0) == (ssize_t)sizeof(bad));
+  CHECK(stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE) == NULL);
+  bad = header;
+  bad.arena_size = UINT64_MAX;
+  CHECK(pwrite(fd, &bad, sizeof(bad), 0) == (ssize_t)sizeof(bad));
+  CHECK(stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE) == NULL);
+  bad = header;
+  bad.block_offset = 0;
+  CHECK(pwrite(fd, &bad, sizeof(bad), 0) == (ssize_t)sizeof(bad));
+  CHECK(stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE) == NULL);
+
+  // a entry that goes past the block
+  CHECK(pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header));
+  uint64_t entry[2] = {0, header.arena_size + 1};
+  CHECK(pwrite(fd, entry, sizeof(entry), sizeof(header)) == (ssize_t)sizeof(entry));
+  CHECK(stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE) == NULL);
+  entry[1] = sizeof(data);
+  CHECK(pwrite(fd, entry, sizeof(entry), sizeof(header)) == (ssize_t)sizeof(entry));
+  Ptr_stack *restored = stack_restore(fd, CSM_RESTORE_COPY_ON_WRITE);
+  CHECK(restored != NULL && memcmp(restored->ptr_list[0].ptr, data, sizeof(data)) == 0);
+  stack_free(restored);
+  close(fd);
+}
+
+int main(void) {
+  test_snapshot_ignores_position();
+  test_snapshot_skips_file_ptrs();
+  test_truncated();
+  return 0;
+}
@@ -0,0 +1,30 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+// a entry copied from the stack itself is read right when the copy grows the arena
+static void test_copy_of_entry(void) {
+  Ptr_stack_soa *stack = create_stack_soa(16);
+  char data[256];
+  memset(data, 'x', sizeof(data));
+  size_t source = stack_soa_new_ptr(stack, data, sizeof(data));
+  CHECK(source != SIZE_MAX);
+  size_t filler = 0;
+  while (stack->arena->capacity - stack->arena->actual_size >= sizeof(data))
+    CHECK(stack_soa_new_ptr(stack, &filler, sizeof(filler)) != SIZE_MAX);
+
+  size_t old_capacity = stack->arena->capacity;
+  size_t copy = stack_soa_new_ptr(stack, stack_soa_data(stack, source), sizeof(data));
+  CHECK(copy != SIZE_MAX);
+  CHECK(stack->arena->capacity > old_capacity);
+  CHECK(memcmp(stack_soa_data(stack, copy), data, sizeof(data)) == 0);
+  CHECK(memcmp(stack_soa_data(stack, source), data, sizeof(data)) == 0);
+  stack_soa_free(stack);
+}
+
+int main(void) {
+  test_copy_of_entry();
+  return 0;
+}
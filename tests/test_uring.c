@@ -0,0 +1,68 @@
+#define _DEFAULT_SOURCE
+#define CSM_IO_URING
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+#include <string.h>
+
+#define SKIPPED 77 // the SKIP_RETURN_CODE of the test
+
+static int temp_fd(void) {
+  char path[] = "/tmp/csm_uringXXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd >= 0);
+  unlink(path);
+  return fd;
+}
+
+// the reads land into the registered arena block, a read past the end of
+// file gets the bytes that exist and the block is registered again after
+// the arena grows
+static void test_read(Uring *ring) {
+  int fd = temp_fd();
+  char data[4096];
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = (char)('a' + i % 26);
+  CHECK(write(fd, data, sizeof(data)) == (ssize_t)sizeof(data));
+
+  Ptr_stack *stack = create_stack(8192);
+  CHECK(uring_register_arena(ring, stack->arena));
+  CHECK(ring->buffer == stack->arena->block);
+
+  Dyn_ptr *first = uring_read(ring, stack, fd, 1000, 0);
+  Dyn_ptr *second = uring_read(ring, stack, fd, 1000, 3596);
+  CHECK(first != NULL && second != NULL);
+  size_t first_index = (size_t)(first - stack->ptr_list);
+  size_t second_index = (size_t)(second - stack->ptr_list);
+  CHECK(uring_register_arena(ring, stack->arena) == false); // reads are queued
+  CHECK(uring_submit_and_wait(ring, stack, 2) == 2);
+
+  first = &stack->ptr_list[first_index];
+  second = &stack->ptr_list[second_index];
+  CHECK(first->size == 1000 && memcmp(first->ptr, data, 1000) == 0);
+  CHECK(second->size == 500 && memcmp(second->ptr, data + 3596, 500) == 0);
+
+  // the arena has no room for it, no read is in flight so it grows
+  Dyn_ptr *big = uring_read(ring, stack, fd, sizeof(data) * 2, 0);
+  CHECK(big != NULL);
+  size_t big_index = (size_t)(big - stack->ptr_list);
+  CHECK(ring->buffer == stack->arena->block && ring->buffer_size == stack->arena->capacity);
+  CHECK(uring_submit_and_wait(ring, stack, 1) == 1);
+  big = &stack->ptr_list[big_index];
+  CHECK(big->size == sizeof(data) && memcmp(big->ptr, data, sizeof(data)) == 0);
+
+  stack_free(stack);
+  close(fd);
+}
+
+int main(void) {
+  Uring *ring = create_uring(8);
+  if (ring == NULL) {
+    fprintf(stderr, "io_uring is not available\n");
+    return SKIPPED;
+  }
+  test_read(ring);
+  uring_free(ring);
+  return 0;
+}
@@ -0,0 +1,35 @@
+#define CSM_IMPLEMENTATION
+#include "CSM.h"
+#include "test.h"
+
+CSM_VEC_DEFINE(Int_vec, int)
+
+// a Arena_vec that grows the arena of a Ptr_stack keeps the Dyn_ptr's valid
+static void test_vec_into_stack(void) {
+  Ptr_stack *stack = create_stack(16);
+  int values[8] = {0};
+  for (int i = 0; i < 8; i++) {
+    values[0] = i * 3;
+    stack_new_ptr(stack, values, sizeof(values));
+  }
+
+  Int_vec vec;
+  CHECK(Int_vec_init_stack(&vec, stack, 0));
+  for (int i = 0; i < 100000; i++)
+    CHECK(Int_vec_push(&vec, i));
+
+  CHECK(Int_vec_len(&vec) == 100000);
+  for (int i = 0; i < 100000; i++)
+    CHECK(*Int_vec_at(&vec, (size_t)i) == i);
+  for (int i = 0; i < 8; i++) {
+    Dyn_ptr *dyn_ptr = &stack->ptr_list[i];
+    CHECK(*get_dyn_ptr_data(int, dyn_ptr) == i * 3);
+  }
+  CHECK(Int_vec_pop(&vec) == 99999);
+  stack_free(stack);
+}
+
+int main(void) {
+  test_vec_into_stack();
+  return 0;
+}